@@ -4,7 +4,6 @@
 #include <vector>
 #include <string>
 #include <queue>
-#include <direct.h>
 #include <chrono>
 
 using namespace std;
@@ -238,14 +237,24 @@ int astar(int D)
     return 0;
 }
 
-int main()
+int main(int argc, char* argv[])
 {
     vector<int> dim = {10, 20, 30, 40, 50};
     //vector<int> dim = {20};
+    //可由命令列指定要跑的維度，例如 ./astar 10 20
+    if(argc > 1){
+        dim.clear();
+        for(int i = 1; i < argc; i++) dim.push_back(atoi(argv[i]));
+    }
 
+    bool missing = false; //有檔案讀不到時結束碼為 1
     for(int D : dim){
         string filename = "3SAT_Dim=" + to_string(D) + ".csv";
         Clause = readCSV(filename);
+        if(Clause.empty()){ //讀不到檔案時不搜尋，否則會在空的子句集上回報有解
+            missing = true;
+            continue;
+        }
         int result = astar(D);
         cout << (result ? "Solution found!" : "No solution") << endl;
 
@@ -263,5 +272,5 @@ int main()
     */
     //int D = getD(Clause);
 
-    return 0;
+    return missing ? 1 : 0;
 }
@@ -1,28 +1,202 @@
 #include <bits/stdc++.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 using namespace std;
 
 // 節點結構
 struct Node {
     bool isLeaf;            // 是否為葉節點
-    int label;              // 如果是葉節點，儲存預測的類別標籤
+    int label;              // 此節點的多數類別（葉節點即為預測類別，內部節點供剪枝使用）
     int featureIndex;       // 分裂所使用的特徵索引（對應第幾維特徵）
-    double threshold;       // 分裂所使用的閾值
+    int samples;            // 落在此節點的訓練樣本數
+    int errors;             // 以多數類別預測時，此節點訓練樣本的錯誤數
+    unsigned char threshold;  // 分裂所使用的閾值；像素為整數，切點 x.5 在訓練時即量化為 x
     Node* left;             // 左子節點指標 (特徵值 <= threshold)
     Node* right;            // 右子節點指標 (特徵值 > threshold)
-    Node(): isLeaf(false), label(-1), featureIndex(-1), threshold(0.0), left(nullptr), right(nullptr) {}
+    Node(): isLeaf(false), label(-1), featureIndex(-1), samples(0), errors(0), threshold(0), left(nullptr), right(nullptr) {}
+};
+
+// 唯讀檔案映射：POSIX 使用 mmap，其他平台退回整檔讀入
+struct MappedFile {
+    const char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    vector<char> buf;
+#else
+    void* addr = MAP_FAILED;
+#endif
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    bool open(const string& path) {
+#ifdef _WIN32
+        ifstream fin(path, ios::binary);
+        if (!fin) return false;
+        buf.assign(istreambuf_iterator<char>(fin), istreambuf_iterator<char>());
+        data = buf.data();
+        size = buf.size();
+        return true;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0) { ::close(fd); return false; }
+        size = (size_t)st.st_size;
+        if (size > 0) {
+            addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED) { ::close(fd); return false; }
+            madvise(addr, size, MADV_SEQUENTIAL);
+            data = (const char*)addr;
+        }
+        ::close(fd);  // 映射建立後即可關閉檔案描述子
+        return true;
+#endif
+    }
+    ~MappedFile() {
+#ifndef _WIN32
+        if (addr != MAP_FAILED) munmap(addr, size);
+#endif
+    }
+};
+
+// 資料集：特徵以列優先 (row-major) 連續存放，每個像素 1 byte
+// X / y 指向自有的 vector（由 CSV 解析）或二進位快取的映射區
+struct Dataset {
+    int rows = 0;
+    int cols = 0;
+    const unsigned char* X = nullptr;   // rows × cols
+    const int* y = nullptr;             // rows 個標籤
+    vector<unsigned char> ownX;
+    vector<int> ownY;
+    shared_ptr<MappedFile> map;
+
+    Dataset() = default;
+    Dataset(const Dataset&) = delete;
+    Dataset& operator=(const Dataset&) = delete;
+    Dataset(Dataset&&) = default;              // vector 搬移後緩衝區位址不變，X / y 仍有效
+    Dataset& operator=(Dataset&&) = default;
+
+    const unsigned char* row(int i) const { return X + (size_t)i * cols; }
+    int at(int i, int f) const { return X[(size_t)i * cols + f]; }
 };
 
 // 全域變數
-static vector<vector<int>> trainFeatures;  // 訓練特徵資料 [樣本索引][特徵索引]
-static vector<int> trainLabels;            // 訓練標籤資料
-static vector<int> testLabels;            // 測試標籤資料
-static vector<int> trainPred;            // 測試標籤資料
-static vector<int> testPred;            // 測試標籤資料
+static Dataset trainSet;                  // 訓練資料 (特徵 + 標籤)
+static Dataset testSet;                   // 測試資料
+static vector<int> trainPred;            // 訓練集預測結果
+static vector<int> testPred;            // 測試集預測結果
 static int numFeatures = 0;               // 特徵維度 (預期 784)
 static int numClasses = 0;                // 類別數量 (MNIST 預期 10)
 
-// 建構決策樹的遞迴函式，參數為當前節點包含的資料索引集合
-Node* buildTree(const vector<int>& dataIndexList) {
+// 預剪枝（提前停止）參數，預設值等同不限制
+struct TreeParams {
+    int maxDepth = INT_MAX;             // 最大深度
+    int minSamplesSplit = 2;            // 節點至少需有此樣本數才嘗試分裂
+    int minSamplesLeaf = 1;             // 分裂後左右子節點各自至少需有的樣本數
+    double minImpurityDecrease = 0.0;   // 加權不純度下降 (N_t / N_root × gain) 低於此值則不分裂
+};
+static TreeParams treeParams;
+static int rootSamples = 0;               // 根節點樣本數，用於加權不純度下降
+
+// 訓練資料非零像素的 CSR（依樣本列出非零的特徵與值）；MNIST 約 80% 像素為 0
+struct SparseRows {
+    vector<int> ptr;                // rows + 1
+    vector<int> col;
+    vector<unsigned char> val;
+};
+static SparseRows trainNZ;
+// 分裂搜尋的暫存區，遞迴進入子節點前就已用完，整棵樹共用
+static vector<int> nzStart;               // 每個特徵在 nzKey 的起點 (numFeatures + 1)
+static vector<int> nzFill;
+static vector<int> nzKey;                 // 值 << 8 | 標籤
+
+// 由稠密資料建立 CSR，並配置分裂搜尋的暫存區
+void buildSparseRows(const Dataset& ds) {
+    trainNZ.ptr.assign(ds.rows + 1, 0);
+    trainNZ.col.clear();
+    trainNZ.val.clear();
+    for (int i = 0; i < ds.rows; ++i) {
+        const unsigned char* r = ds.row(i);
+        for (int f = 0; f < ds.cols; ++f) {
+            if (r[f] == 0) continue;
+            trainNZ.col.push_back(f);
+            trainNZ.val.push_back(r[f]);
+        }
+        trainNZ.ptr[i + 1] = trainNZ.col.size();
+    }
+    nzStart.assign(ds.cols + 1, 0);
+}
+
+// ===== 訓練剖析 (--profile) =====
+// 各階段累計秒數：histogram = 非零項分桶與零值桶計數，sort = 非零項排序，
+// gain = 掃描候選分裂點，partition = 切分左右索引；未啟用時不讀時鐘
+struct TrainProfile {
+    bool enabled = false;
+    double histogramSec = 0, sortSec = 0, gainSec = 0, partitionSec = 0;
+    vector<double> depthSec;          // 各深度節點本身（不含子樹）的耗時
+    vector<long long> depthNodes, depthSamples;
+};
+static TrainProfile prof;
+using ProfClock = chrono::steady_clock;
+
+static inline ProfClock::time_point profTick() {
+    return prof.enabled ? ProfClock::now() : ProfClock::time_point();
+}
+// 把自 t 起的時間累加到 acc，並將 t 移到現在，供下一階段接續計時
+static inline void profAdd(double& acc, ProfClock::time_point& t) {
+    if (!prof.enabled) return;
+    auto now = ProfClock::now();
+    acc += chrono::duration<double>(now - t).count();
+    t = now;
+}
+
+// 記錄單一節點本身的耗時；遞迴前呼叫 stop()，其餘離開路徑由解構子記錄
+struct NodeTimer {
+    int depth;
+    ProfClock::time_point start = profTick();
+    bool done = !prof.enabled;
+    NodeTimer(int d, int samples) : depth(d) {
+        if (done) return;
+        if ((int)prof.depthSec.size() <= d) {
+            prof.depthSec.resize(d + 1, 0.0);
+            prof.depthNodes.resize(d + 1, 0);
+            prof.depthSamples.resize(d + 1, 0);
+        }
+        prof.depthNodes[d]++;
+        prof.depthSamples[d] += samples;
+    }
+    void stop() {
+        if (done) return;
+        done = true;
+        prof.depthSec[depth] += chrono::duration<double>(ProfClock::now() - start).count();
+    }
+    ~NodeTimer() { stop(); }
+};
+
+// 以 operator new 統計配置次數與位元組數，用於回報訓練期間的配置量
+static atomic<size_t> allocBytes{0};
+static atomic<size_t> allocCount{0};
+
+void* operator new(size_t n) {
+    allocBytes.fetch_add(n, memory_order_relaxed);
+    allocCount.fetch_add(1, memory_order_relaxed);
+    if (void* p = malloc(n ? n : 1)) return p;
+    throw bad_alloc();
+}
+// 不內聯，避免 GCC 將 malloc/free 配對誤判為 new/delete 不相符
+__attribute__((noinline)) void operator delete(void* p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { free(p); }
+
+// 建構決策樹的遞迴函式，參數為當前節點包含的資料索引集合與深度
+Node* buildTree(const vector<int>& dataIndexList, int depth = 0) {
+    NodeTimer timer(depth, dataIndexList.size());
     // 節點初始化
     Node* node = new Node();
     // 如果當前節點的資料列表為空，返回空（不應發生此情況，僅防禦性處理）
@@ -31,28 +205,22 @@ Node* buildTree(const vector<int>& dataIndexList) {
         node->label = 0;
         return node;
     }
-    // 檢查此節點資料是否全屬於同一類別
-    int firstLabel = trainLabels[dataIndexList[0]];
-    bool allSame = true;
+    // 計算當前節點的類別分佈，用於計算不純度
+    vector<int> labelCount(numClasses, 0); //記錄此節點每個類別出現的次數
     for (int idx : dataIndexList) {
-        if (trainLabels[idx] != firstLabel) {
-            allSame = false;
-            break;
-        }
+        labelCount[trainSet.y[idx]]++;
     }
-    if (allSame) {
-        // 如果所有樣本標籤相同，直接作為葉節點標記該類別
+    int N = dataIndexList.size();
+    int majorityClass = distance(labelCount.begin(), max_element(labelCount.begin(), labelCount.end()));
+    node->label = majorityClass;
+    node->samples = N;
+    node->errors = N - labelCount[majorityClass];
+    // 如果所有樣本標籤相同，或已達深度 / 樣本數門檻，直接作為葉節點
+    if (node->errors == 0 || depth >= treeParams.maxDepth || N < treeParams.minSamplesSplit) {
         node->isLeaf = true;
-        node->label = firstLabel;
         return node;
     }
-    // 計算當前節點的類別分佈，用於計算不純度
-    vector<int> labelCount(numClasses, 0); //記錄此節點每個類別出現的次數
-    for (int idx : dataIndexList) {
-        labelCount[trainLabels[idx]]++;
-    }
     // 計算基尼不純度 (Gini impurity) = 1 - Σ((count[c]/N)^2)
-    int N = dataIndexList.size();
     double parentImpurity = 1.0;
     for (int c = 0; c < numClasses; ++c) {
         if (labelCount[c] > 0) {
@@ -60,83 +228,112 @@ Node* buildTree(const vector<int>& dataIndexList) {
             parentImpurity -= p * p;
         }
     }
-    // 若當前節點已無不純度（純淨單一類別），則成為葉節點（理論上已在 allSame 處理，此處再次檢查）
+    // 若當前節點已無不純度（純淨單一類別），則成為葉節點（理論上已在 errors == 0 處理，此處再次檢查）
     if (parentImpurity == 0.0) {
         node->isLeaf = true;
-        // 選擇具有最多樣本數的類別作為葉節點預測（其實 allSame 時已返回，這裡作保險）
-        int majorityClass = distance(labelCount.begin(), max_element(labelCount.begin(), labelCount.end()));
-        node->label = majorityClass;
         return node;
     }
+    const int minLeaf = treeParams.minSamplesLeaf;
 
     // 初始化最佳分裂變數
     double bestImpurityGain = 0.0;
     int bestFeatureIndex = -1;
-    double bestThreshold = 0.0;
+    int bestThreshold = 0;
 
-    // 嘗試每一個特徵作為分裂依據
-    for (int f = 0; f < numFeatures; ++f) {
-        // 提取該特徵在此節點資料中的值和標籤
-        vector<pair<int,int>> featVals;
-        featVals.reserve(N);
-        for (int idx : dataIndexList) {
-            featVals.emplace_back(trainFeatures[idx][f], trainLabels[idx]);
+    // 將此節點樣本的非零像素依特徵分桶 (CSC)：先計數、前綴和，再填入「值 << 8 | 標籤」
+    // 工作量與此節點的非零數成正比，不需逐一複製 N 個值
+    auto tPhase = profTick();
+    vector<int>& start = nzStart;
+    fill(start.begin(), start.end(), 0);
+    for (int idx : dataIndexList) {
+        for (int k = trainNZ.ptr[idx]; k < trainNZ.ptr[idx + 1]; ++k) start[trainNZ.col[k] + 1]++;
+    }
+    for (int f = 0; f < numFeatures; ++f) start[f + 1] += start[f];
+    nzFill.assign(start.begin(), start.end() - 1);
+    nzKey.resize(start[numFeatures]);
+    for (int idx : dataIndexList) {
+        int label = trainSet.y[idx];
+        for (int k = trainNZ.ptr[idx]; k < trainNZ.ptr[idx + 1]; ++k) {
+            nzKey[nzFill[trainNZ.col[k]]++] = (int)trainNZ.val[k] << 8 | label;
+        }
+    }
+    profAdd(prof.histogramSec, tPhase);
+
+    // 左右子集類別計數，用於計算不純度
+    vector<int> leftCount(numClasses, 0);
+    vector<int> rightCount(numClasses, 0);
+    int leftSize = 0;
+    int rightSize = 0;
+    int f = 0;
+    // 在值 lo 與 hi 之間切一刀，計算此分裂點的基尼不純度
+    auto tryCut = [&](int lo, int hi) {
+        if (leftSize < minLeaf || rightSize < minLeaf) return;
+        double giniLeft = 1.0;
+        double giniRight = 1.0;
+        for (int c = 0; c < numClasses; ++c) {
+            if (leftCount[c] > 0) {
+                double pL = (double)leftCount[c] / leftSize;
+                giniLeft -= pL * pL;
+            }
+            if (rightCount[c] > 0) {
+                double pR = (double)rightCount[c] / rightSize;
+                giniRight -= pR * pR;
+            }
+        }
+        double weightedGini = (double)leftSize / N * giniLeft + (double)rightSize / N * giniRight;
+        double impurityGain = parentImpurity - weightedGini;
+        // 如果此分裂帶來更大的不純度降低，則更新最佳分裂
+        if (impurityGain > bestImpurityGain) {
+            bestImpurityGain = impurityGain;
+            bestFeatureIndex = f;
+            // 閾值取兩個不同值的中點，像素為整數，取下整數即得相同的切分
+            bestThreshold = (lo + hi) / 2;
         }
-        // 根據特徵值排序
-        sort(featVals.begin(), featVals.end(),
-             [](const pair<int,int>& a, const pair<int,int>& b){ return a.first < b.first; });
-        // 若該特徵對所有樣本值都相同，則無法通過此特徵分裂，跳過
-        if (featVals.front().first == featVals.back().first) {
-            continue;
+    };
+
+    // 嘗試每一個特徵作為分裂依據
+    for (f = 0; f < numFeatures; ++f) {
+        int nnz = start[f + 1] - start[f];
+        // 此節點該特徵全為 0：常數特徵，直接跳過
+        if (nnz == 0) continue;
+        int* keys = nzKey.data() + start[f];
+        // 只排序非零項；像素值不小於 0，零值桶必在最左側
+        sort(keys, keys + nnz);
+        profAdd(prof.sortSec, tPhase);
+        // 若該特徵對所有樣本值都相同（全部非零且同值），則無法分裂，跳過
+        if (nnz == N && (keys[0] >> 8) == (keys[nnz - 1] >> 8)) continue;
+        profAdd(prof.gainSec, tPhase);
+
+        // 零值桶的類別計數 = 父節點計數 - 非零項計數，一開始整個零值桶在左側
+        leftCount = labelCount;
+        fill(rightCount.begin(), rightCount.end(), 0);
+        for (int i = 0; i < nnz; ++i) {
+            leftCount[keys[i] & 0xFF]--;
+            rightCount[keys[i] & 0xFF]++;
         }
-        // 左右子集類別計數，用於計算不純度
-        vector<int> leftCount(numClasses, 0);
-        vector<int> rightCount = labelCount;  // 初始右側包含全部樣本
-        int leftSize = 0;
-        int rightSize = N;
-        // 掃描可能的分裂點
-        for (int i = 0; i < N - 1; ++i) {
-            int val = featVals[i].first;
-            int label = featVals[i].second;
+        leftSize = N - nnz;
+        rightSize = nnz;
+        profAdd(prof.histogramSec, tPhase);
+        if (leftSize > 0) tryCut(0, keys[0] >> 8);
+        // 掃描非零值之間的分裂點
+        for (int i = 0; i < nnz - 1; ++i) {
+            int val = keys[i] >> 8;
+            int label = keys[i] & 0xFF;
             // 將當前樣本從右側移動到左側
             leftCount[label] += 1;
             rightCount[label] -= 1;
             leftSize++;
             rightSize--;
-            // 檢查當前值與下一個值是否不同，只有在值改變的邊界才是候選分裂點
-            if (val != featVals[i+1].first) {
-                // 計算此分裂點的基尼不純度
-                double giniLeft = 1.0;
-                double giniRight = 1.0;
-                for (int c = 0; c < numClasses; ++c) {
-                    if (leftCount[c] > 0) {
-                        double pL = (double)leftCount[c] / leftSize;
-                        giniLeft -= pL * pL;
-                    }
-                    if (rightCount[c] > 0) {
-                        double pR = (double)rightCount[c] / rightSize;
-                        giniRight -= pR * pR;
-                    }
-                }
-                double weightedGini = (double)leftSize / N * giniLeft + (double)rightSize / N * giniRight;
-                double impurityGain = parentImpurity - weightedGini;
-                // 如果此分裂帶來更大的不純度降低，則更新最佳分裂
-                if (impurityGain > bestImpurityGain) {
-                    bestImpurityGain = impurityGain;
-                    bestFeatureIndex = f;
-                    // 閾值取兩個不同值的中點
-                    bestThreshold = ((double)val + (double)featVals[i+1].first) / 2.0;
-                }
-            }
+            // 只有在值改變的邊界才是候選分裂點
+            if (val != (keys[i + 1] >> 8)) tryCut(val, keys[i + 1] >> 8);
         }
+        profAdd(prof.gainSec, tPhase);
     }
 
-    // 如果未找到有效的分裂（bestFeatureIndex仍為-1或增益為0），將此節點作為葉節點
-    if (bestFeatureIndex == -1 || bestImpurityGain <= 1e-12) {
+    // 如果未找到有效的分裂（bestFeatureIndex仍為-1或增益為0），或加權增益不足，將此節點作為葉節點
+    if (bestFeatureIndex == -1 || bestImpurityGain <= 1e-12
+        || (double)N / rootSamples * bestImpurityGain < treeParams.minImpurityDecrease) {
         node->isLeaf = true;
-        // 選擇最多數據的類別作為葉節點類別
-        int majorityClass = distance(labelCount.begin(), max_element(labelCount.begin(), labelCount.end()));
-        node->label = majorityClass;
         return node;
     }
 
@@ -151,24 +348,26 @@ Node* buildTree(const vector<int>& dataIndexList) {
     rightIndices.reserve(N);
     // 如果樣本在第 bestFeatureIndex 維度上的值 ≤ bestThreshold，就歸到左子樹；否則就到右子樹
     for (int idx : dataIndexList) {
-        if ((double)trainFeatures[idx][bestFeatureIndex] <= bestThreshold) {
+        if (trainSet.at(idx, bestFeatureIndex) <= bestThreshold) {
             leftIndices.push_back(idx);
         } else {
             rightIndices.push_back(idx);
         }
     }
+    profAdd(prof.partitionSec, tPhase);
+    timer.stop();
     // 遞迴建立左子樹和右子樹
-    node->left = buildTree(leftIndices);
-    node->right = buildTree(rightIndices);
+    node->left = buildTree(leftIndices, depth + 1);
+    node->right = buildTree(rightIndices, depth + 1);
     return node;
 }
 
 // 使用訓練好的決策樹對單一樣本進行預測
-int predict(const Node* node, const vector<int>& features) {
+int predict(const Node* node, const unsigned char* features) {
     const Node* cur = node;
     while (!cur->isLeaf) {
         // 根據當前節點的分裂規則，決定走向左或右子樹
-        if ((double)features[cur->featureIndex] <= cur->threshold) {
+        if (features[cur->featureIndex] <= cur->threshold) {
             cur = cur->left;
         } else {
             cur = cur->right;
@@ -205,13 +404,507 @@ void sumLeafDepth(Node* node, int depth, int& totalDepth, int& leafCount) {
     sumLeafDepth(node->left, depth + 1, totalDepth, leafCount);
     sumLeafDepth(node->right, depth + 1, totalDepth, leafCount);
 }
-double compute_macro_f1(const vector<int>& true_labels, const vector<int>& pred_labels) {
+// ===== 成本複雜度後剪枝 (Cost-Complexity Pruning) =====
+// 以訓練錯誤數 R(t) 計算每個內部節點的有效 α = (R(t) - R(T_t)) / (|leaves(T_t)| - 1)，
+// 每步剪去 α 最小的節點得到一串由大到小的子樹，選出驗證集正確數最多者（同分取較小的樹）
+struct PruneResult {
+    int steps = 0;          // 所選子樹對應的剪枝步數（每步剪去一個內部節點的子樹）
+    double alpha = 0.0;     // 所選子樹對應的 α
+    int valCorrect = 0;     // 剪枝後驗證集正確數
+    int valBefore = 0;      // 剪枝前驗證集正確數
+};
+
+PruneResult costComplexityPrune(Node* root, const vector<int>& valIndices) {
+    // 前序收集節點；子樹 i 佔據 [i, i + size[i])
+    vector<Node*> nodes;
+    vector<int> parent, leftOf, rightOf;
+    vector<pair<Node*, int>> stack = {{root, -1}};
+    while (!stack.empty()) {
+        auto [node, par] = stack.back();
+        stack.pop_back();
+        int self = (int)nodes.size();
+        nodes.push_back(node);
+        parent.push_back(par);
+        leftOf.push_back(-1);
+        rightOf.push_back(-1);
+        if (par >= 0) (nodes[par]->left == node ? leftOf[par] : rightOf[par]) = self;
+        if (!node->isLeaf) {
+            stack.push_back({node->right, self});
+            stack.push_back({node->left, self});
+        }
+    }
+    int n = nodes.size();
+
+    // 驗證樣本沿樹走訪，累計每個節點「若作為葉節點」的正確數
+    vector<int> valLeaf(n, 0);
+    for (int idx : valIndices) {
+        int i = 0;
+        while (true) {
+            valLeaf[i] += (nodes[i]->label == trainSet.y[idx]);
+            if (nodes[i]->isLeaf) break;
+            i = (trainSet.at(idx, nodes[i]->featureIndex) <= nodes[i]->threshold) ? leftOf[i] : rightOf[i];
+        }
+    }
+
+    // 由下而上彙總子樹的訓練錯誤數、葉節點數、驗證正確數
+    vector<int> size(n, 1), errSub(n), leaves(n), valSub(n);
+    vector<char> pruned(n, 0);
+    for (int i = n - 1; i >= 0; --i) {
+        if (nodes[i]->isLeaf) {
+            errSub[i] = nodes[i]->errors;
+            leaves[i] = 1;
+            valSub[i] = valLeaf[i];
+        } else {
+            int l = leftOf[i], r = rightOf[i];
+            size[i] = 1 + size[l] + size[r];
+            errSub[i] = errSub[l] + errSub[r];
+            leaves[i] = leaves[l] + leaves[r];
+            valSub[i] = valSub[l] + valSub[r];
+        }
+    }
+
+    PruneResult res;
+    res.valBefore = res.valCorrect = valSub[0];
+    vector<int> order;          // 依序被剪的節點（子孫必在祖先之前）
+    double bestAlpha = 0.0;
+    while (!nodes[0]->isLeaf && !pruned[0]) {
+        // 找出目前子樹中 α 最小的內部節點；已剪節點的子孫整段跳過
+        int weakest = -1;
+        double minAlpha = numeric_limits<double>::infinity();
+        for (int i = 0; i < n;) {
+            if (pruned[i] || nodes[i]->isLeaf) {
+                i += pruned[i] ? size[i] : 1;
+                continue;
+            }
+            double g = (double)(nodes[i]->errors - errSub[i]) / (leaves[i] - 1);
+            if (g < minAlpha) {
+                minAlpha = g;
+                weakest = i;
+            }
+            ++i;
+        }
+        // 剪去 weakest，並把差值沿祖先往上更新
+        int dErr = nodes[weakest]->errors - errSub[weakest];
+        int dLeaves = 1 - leaves[weakest];
+        int dVal = valLeaf[weakest] - valSub[weakest];
+        for (int a = weakest; a >= 0; a = parent[a]) {
+            errSub[a] += dErr;
+            leaves[a] += dLeaves;
+            valSub[a] += dVal;
+        }
+        pruned[weakest] = 1;
+        order.push_back(weakest);
+        if (valSub[0] >= res.valCorrect) {
+            res.valCorrect = valSub[0];
+            res.steps = order.size();
+            bestAlpha = minAlpha;
+        }
+    }
+    res.alpha = bestAlpha;
+
+    // 套用所選的子樹：依剪枝順序把節點改為葉節點並釋放其子樹
+    for (int k = 0; k < res.steps; ++k) {
+        Node* t = nodes[order[k]];
+        deleteTree(t->left);
+        deleteTree(t->right);
+        t->left = t->right = nullptr;
+        t->isLeaf = true;
+    }
+    return res;
+}
+
+static volatile long long predictSink = 0;  // 吸收預測結果，避免編譯器省略測速迴圈
+
+// 回傳每秒預測樣本數：先不計時預測一次讓資料與節點進入快取，再取 THROUGHPUT_PASSES 次中最快的一次，
+// 剪枝前後的樹因此都在相同的暖快取狀態下量測
+static const int THROUGHPUT_PASSES = 5;
+double predictThroughput(const Node* root, const Dataset& ds) {
+    long long checksum = 0;
+    for (int i = 0; i < ds.rows; ++i) checksum += predict(root, ds.row(i));
+    double best = 0.0;
+    for (int pass = 0; pass < THROUGHPUT_PASSES; ++pass) {
+        auto start = chrono::high_resolution_clock::now();
+        for (int i = 0; i < ds.rows; ++i) checksum += predict(root, ds.row(i));
+        chrono::duration<double> sec = chrono::high_resolution_clock::now() - start;
+        if (pass == 0 || sec.count() < best) best = sec.count();
+    }
+    predictSink = checksum;
+    return best > 0 ? ds.rows / best : 0.0;
+}
+
+// 印出樹的節點數、平均葉深度與預測吞吐量
+void reportTree(const char* tag, Node* root, const Dataset& ds) {
+    int totalDepth = 0, leafCount = 0;
+    sumLeafDepth(root, 0, totalDepth, leafCount);
+    cout << tag << ": nodes=" << countNodes(root)
+         << " avg leaf depth=" << (double)totalDepth / leafCount
+         << " throughput(samples/s)=" << predictThroughput(root, ds) << endl;
+}
+// ===== CSV 讀取 =====
+// 格式：每列 numFeatures 個像素值，最後一欄為標籤；空欄位視為 0，不足 784 欄補 0
+
+// 跳過此列剩餘內容，回傳下一列開頭
+static inline const char* skipLine(const char* p, const char* end) {
+    const char* nl = (const char*)memchr(p, '\n', end - p);
+    return nl ? nl + 1 : end;
+}
+
+// 判斷 [p, end) 開頭的這一列是否為空行（僅有 '\r' 也算空行）
+static inline bool isBlankLine(const char* p, const char* end) {
+    return p >= end || *p == '\n' || (*p == '\r' && (p + 1 >= end || p[1] == '\n'));
+}
+
+// 逐欄解析數值寫入 row 的前 cols 格（呼叫前已清為 0），停在行尾；
+// 數字逐位累加，不經過 string / stoi；像素值大於 255 時截為 255
+// fields 回傳欄位數，last 回傳最後一欄的原始值
+static const char* parseValues(const char* p, const char* end, unsigned char* row, int cols, int& fields, int& last) {
+    int k = 0;
+    while (true) {
+        while (p < end && *p == ' ') ++p;
+        int v = 0;
+        unsigned d;
+        while (p < end && (d = (unsigned)(*p - '0')) < 10) {
+            v = v * 10 + (int)d;
+            ++p;
+        }
+        if (k < cols) row[k] = (unsigned char)min(v, 255);
+        last = v;
+        ++k;
+        if (p >= end || *p != ',') break;
+        ++p;
+    }
+    fields = k;
+    return p;
+}
+
+// 解析一列「特徵..., 標籤」，回傳下一列開頭
+static const char* parseRow(const char* p, const char* end, unsigned char* row, int cols, int& label) {
+    int fields = 0;
+    p = parseValues(p, end, row, cols, fields, label);
+    // 最後一個值為標籤，先前已寫入特徵欄位，需清回 0
+    if (fields - 1 < cols) row[fields - 1] = 0;
+    return skipLine(p, end);
+}
+
+// 依換行切成 nChunks 段，每段起點都在某一列開頭
+static vector<const char*> splitChunks(const char* begin, const char* end, int nChunks) {
+    vector<const char*> cut(nChunks + 1);
+    size_t size = end - begin;
+    cut[0] = begin;
+    for (int t = 1; t < nChunks; ++t) {
+        const char* p = begin + size * t / nChunks;
+        if (p < cut[t - 1]) p = cut[t - 1];
+        cut[t] = (p > begin && p[-1] != '\n') ? skipLine(p, end) : p;
+    }
+    cut[nChunks] = end;
+    return cut;
+}
+
+// 解析整份 CSV：第一遍各執行緒計算自己區段的列數，前綴和決定輸出位置，
+// 第二遍各自解析並直接寫進連續的特徵陣列
+bool parseCSV(const string& file, Dataset& ds, int nThreads) {
+    auto mf = make_shared<MappedFile>();
+    if (!mf->open(file)) {
+        cerr << "Cannot open the file: " << file << "\n";
+        return false;
+    }
+    const char* begin = mf->data;
+    const char* end = mf->data + mf->size;
+
+    // 以第一個非空行的欄位數決定特徵維度（至少 784）
+    const char* first = begin;
+    while (first < end && isBlankLine(first, end)) first = skipLine(first, end);
+    const char* firstEnd = skipLine(first, end);
+    int fields = first < end ? 1 + (int)count(first, firstEnd, ',') : 0;
+    ds.cols = max(784, fields - 1);
+
+    // 每段至少 1 MB，避免小檔案開過多執行緒
+    const size_t minChunk = 1 << 20;
+    int nChunks = (int)max<size_t>(1, min<size_t>((size_t)max(nThreads, 1), mf->size / minChunk));
+    vector<const char*> cut = splitChunks(begin, end, nChunks);
+
+    vector<size_t> rowStart(nChunks + 1, 0);
+    auto countRows = [&](int t) {
+        size_t n = 0;
+        for (const char* p = cut[t]; p < cut[t + 1]; p = skipLine(p, cut[t + 1])) {
+            if (!isBlankLine(p, cut[t + 1])) ++n;
+        }
+        rowStart[t + 1] = n;
+    };
+    auto parseChunk = [&](int t) {
+        size_t r = rowStart[t];
+        for (const char* p = cut[t]; p < cut[t + 1];) {
+            if (isBlankLine(p, cut[t + 1])) {
+                p = skipLine(p, cut[t + 1]);
+                continue;
+            }
+            p = parseRow(p, cut[t + 1], ds.ownX.data() + r * ds.cols, ds.cols, ds.ownY[r]);
+            ++r;
+        }
+    };
+    auto runAll = [&](const function<void(int)>& job) {
+        vector<thread> workers;
+        for (int t = 1; t < nChunks; ++t) workers.emplace_back(job, t);
+        job(0);
+        for (auto& w : workers) w.join();
+    };
+
+    runAll(countRows);
+    for (int t = 0; t < nChunks; ++t) rowStart[t + 1] += rowStart[t];
+    ds.rows = (int)rowStart[nChunks];
+    ds.ownX.assign((size_t)ds.rows * ds.cols, 0);
+    ds.ownY.assign(ds.rows, 0);
+    runAll(parseChunk);
+
+    ds.X = ds.ownX.data();
+    ds.y = ds.ownY.data();
+    return true;
+}
+
+// ===== 二進位快取 =====
+// 檔頭之後依序為 rows 個 int32 標籤與 rows × cols 個像素 byte，
+// 載入時整檔一次 mmap，X / y 直接指向映射區
+struct CacheHeader {
+    char magic[8];          // "DTCACHE1"
+    int32_t rows;
+    int32_t cols;
+    int64_t srcSize;        // 來源 CSV 大小與修改時間，任一不符即重新解析
+    int64_t srcMtime;
+};
+static const char CACHE_MAGIC[8] = {'D', 'T', 'C', 'A', 'C', 'H', 'E', '1'};
+
+static bool sourceStamp(const string& file, int64_t& size, int64_t& mtime) {
+    error_code ec;
+    size = (int64_t)filesystem::file_size(file, ec);
+    if (ec) return false;
+    mtime = (int64_t)filesystem::last_write_time(file, ec).time_since_epoch().count();
+    return !ec;
+}
+
+static bool loadCache(const string& cacheFile, const string& srcFile, Dataset& ds) {
+    int64_t srcSize, srcMtime;
+    if (!sourceStamp(srcFile, srcSize, srcMtime)) return false;
+    auto mf = make_shared<MappedFile>();
+    if (!mf->open(cacheFile) || mf->size < sizeof(CacheHeader)) return false;
+    CacheHeader h;
+    memcpy(&h, mf->data, sizeof(h));
+    if (memcmp(h.magic, CACHE_MAGIC, 8) != 0 || h.srcSize != srcSize || h.srcMtime != srcMtime) return false;
+    if (h.rows < 0 || h.cols <= 0) return false;
+    size_t expect = sizeof(CacheHeader) + (size_t)h.rows * sizeof(int32_t) + (size_t)h.rows * h.cols;
+    if (mf->size != expect) return false;
+
+    ds.rows = h.rows;
+    ds.cols = h.cols;
+    ds.y = (const int*)(mf->data + sizeof(CacheHeader));
+    ds.X = (const unsigned char*)(mf->data + sizeof(CacheHeader) + (size_t)h.rows * sizeof(int32_t));
+    ds.map = mf;
+    return true;
+}
+
+static void writeCache(const string& cacheFile, const string& srcFile, const Dataset& ds) {
+    CacheHeader h;
+    memcpy(h.magic, CACHE_MAGIC, 8);
+    h.rows = ds.rows;
+    h.cols = ds.cols;
+    if (!sourceStamp(srcFile, h.srcSize, h.srcMtime)) return;
+    ofstream fout(cacheFile, ios::binary);
+    if (!fout) {
+        cerr << "Cannot write the cache file: " << cacheFile << "\n";
+        return;
+    }
+    fout.write((const char*)&h, sizeof(h));
+    fout.write((const char*)ds.y, (streamsize)ds.rows * sizeof(int32_t));
+    fout.write((const char*)ds.X, (streamsize)ds.rows * ds.cols);
+}
+
+// 讀取資料集；useCache 時優先使用 <file>.bin，無效則解析 CSV 後重建快取
+bool loadDataset(const string& file, Dataset& ds, int nThreads, bool useCache) {
+    string cacheFile = file + ".bin";
+    if (useCache && loadCache(cacheFile, file, ds)) return true;
+    if (!parseCSV(file, ds, nThreads)) return false;
+    if (useCache) writeCache(cacheFile, file, ds);
+    return true;
+}
+
+// ===== 模型檔 =====
+// 訓練後將樹攤平成前序 (preorder) 的連續節點陣列：左子節點必為 i + 1，只需記錄右子節點索引
+// 檔案 = ModelHeader + nodeCount 個 FlatNode，可直接 mmap 後使用，不需重建指標
+struct FlatNode {
+    int32_t next;           // 內部節點：右子節點索引；葉節點：預測類別
+    uint16_t feature;       // LEAF_FEATURE 表示葉節點
+    uint8_t threshold;      // 特徵值 <= threshold 走左子樹
+    uint8_t pad;
+};
+static const uint16_t LEAF_FEATURE = 0xFFFF;
+struct ModelHeader {
+    char magic[8];          // "DTMODEL\0"
+    int32_t version;
+    int32_t numFeatures;
+    int32_t numClasses;
+    int32_t nodeCount;
+    int32_t reserved[2];
+};
+static const char MODEL_MAGIC[8] = {'D', 'T', 'M', 'O', 'D', 'E', 'L', '\0'};
+static const int32_t MODEL_VERSION = 2;    // 2：閾值量化為 uint8，節點 8 bytes
+
+struct FlatModel {
+    int numFeatures = 0;
+    int numClasses = 0;
+    int nodeCount = 0;
+    const FlatNode* nodes = nullptr;
+    vector<FlatNode> own;
+    shared_ptr<MappedFile> map;
+};
+
+// 前序走訪將指標樹寫入 out
+void flattenTree(const Node* node, vector<FlatNode>& out) {
+    int self = (int)out.size();
+    out.push_back({node->label, node->isLeaf ? LEAF_FEATURE : (uint16_t)node->featureIndex, node->threshold, 0});
+    if (node->isLeaf) return;
+    flattenTree(node->left, out);
+    out[self].next = (int)out.size();
+    flattenTree(node->right, out);
+}
+
+bool saveModel(const string& file, const vector<FlatNode>& nodes) {
+    if (numFeatures >= LEAF_FEATURE) {
+        cerr << "Too many features for the model file: " << numFeatures << "\n";
+        return false;
+    }
+    ModelHeader h{};
+    memcpy(h.magic, MODEL_MAGIC, 8);
+    h.version = MODEL_VERSION;
+    h.numFeatures = numFeatures;
+    h.numClasses = numClasses;
+    h.nodeCount = (int32_t)nodes.size();
+    ofstream fout(file, ios::binary);
+    if (!fout) {
+        cerr << "Cannot write the model file: " << file << "\n";
+        return false;
+    }
+    fout.write((const char*)&h, sizeof(h));
+    fout.write((const char*)nodes.data(), (streamsize)nodes.size() * sizeof(FlatNode));
+    return (bool)fout;
+}
+
+// 載入模型並檢查所有索引都在範圍內，之後走訪不需再做邊界檢查
+bool loadModel(const string& file, FlatModel& model) {
+    auto mf = make_shared<MappedFile>();
+    if (!mf->open(file)) {
+        cerr << "Cannot open the model file: " << file << "\n";
+        return false;
+    }
+    ModelHeader h;
+    if (mf->size < sizeof(h)) {
+        cerr << "Invalid model file: " << file << "\n";
+        return false;
+    }
+    memcpy(&h, mf->data, sizeof(h));
+    if (memcmp(h.magic, MODEL_MAGIC, 8) != 0 || h.version != MODEL_VERSION || h.nodeCount <= 0
+        || mf->size != sizeof(h) + (size_t)h.nodeCount * sizeof(FlatNode)) {
+        cerr << "Invalid model file: " << file << "\n";
+        return false;
+    }
+    const FlatNode* nodes = (const FlatNode*)(mf->data + sizeof(h));
+    for (int i = 0; i < h.nodeCount; ++i) {
+        const FlatNode& n = nodes[i];
+        bool ok = n.feature == LEAF_FEATURE
+                      ? (n.next >= 0 && n.next < h.numClasses)
+                      : (n.feature < h.numFeatures && i + 1 < h.nodeCount
+                         && n.next > i + 1 && n.next < h.nodeCount);
+        if (!ok) {
+            cerr << "Corrupted model node " << i << " in " << file << "\n";
+            return false;
+        }
+    }
+    model.numFeatures = h.numFeatures;
+    model.numClasses = h.numClasses;
+    model.nodeCount = h.nodeCount;
+    model.nodes = nodes;
+    model.map = mf;
+    return true;
+}
+
+int predictFlat(const FlatNode* nodes, const unsigned char* features) {
+    int i = 0;
+    while (nodes[i].feature != LEAF_FEATURE) {
+        i = (features[nodes[i].feature] <= nodes[i].threshold) ? i + 1 : nodes[i].next;
+    }
+    return nodes[i].next;
+}
+
+// 16 筆樣本同時走訪攤平的樹：rows 為 16 筆連續、每筆 stride bytes 的樣本，之後至少還有 3 bytes 可讀
+// AVX2 以 gather 一次取 8 個節點與 8 個像素（讀 4 bytes 取低位元組），比較後以 blend 選子節點；
+// 已到葉節點的通道停在原地，兩組 8 通道交錯以重疊 gather 延遲，全部到葉節點才結束。未啟用 AVX2 時逐筆走訪
+static const int TRAVERSE_LANES = 16;
+#ifdef __AVX2__
+struct LaneGroup {
+    __m256i idx, next, leaf;
+};
+// 讀取目前節點；已全部到葉節點時回傳 true，否則前進一層
+static inline bool laneStep(const int* words, const unsigned char* rows, __m256i laneOffset, LaneGroup& g) {
+    const __m256i low8 = _mm256_set1_epi32(0xFF);
+    g.next = _mm256_i32gather_epi32(words, g.idx, 8);
+    __m256i info = _mm256_i32gather_epi32(words + 1, g.idx, 8);     // feature | threshold << 16
+    __m256i feature = _mm256_and_si256(info, _mm256_set1_epi32(0xFFFF));
+    g.leaf = _mm256_cmpeq_epi32(feature, _mm256_set1_epi32(LEAF_FEATURE));
+    if (_mm256_movemask_epi8(g.leaf) == -1) return true;
+    __m256i threshold = _mm256_and_si256(_mm256_srli_epi32(info, 16), low8);
+    __m256i offset = _mm256_add_epi32(laneOffset, _mm256_andnot_si256(g.leaf, feature));
+    __m256i x = _mm256_and_si256(_mm256_i32gather_epi32((const int*)rows, offset, 1), low8);
+    __m256i child = _mm256_blendv_epi8(_mm256_add_epi32(g.idx, _mm256_set1_epi32(1)), g.next,
+                                       _mm256_cmpgt_epi32(x, threshold));
+    g.idx = _mm256_blendv_epi8(child, g.idx, g.leaf);
+    return false;
+}
+#endif
+static void traverse16(const FlatNode* nodes, const unsigned char* rows, int stride, int* out) {
+#ifdef __AVX2__
+    const int* words = (const int*)nodes;
+    const __m256i lane = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(stride));
+    const __m256i laneHi = _mm256_add_epi32(lane, _mm256_set1_epi32(8 * stride));
+    LaneGroup a, b;
+    a.idx = b.idx = _mm256_setzero_si256();
+    bool doneA = false, doneB = false;
+    while (!(doneA && doneB)) {
+        if (!doneA) doneA = laneStep(words, rows, lane, a);
+        if (!doneB) doneB = laneStep(words, rows, laneHi, b);
+    }
+    _mm256_storeu_si256((__m256i*)out, a.next);
+    _mm256_storeu_si256((__m256i*)(out + 8), b.next);
+#else
+    for (int k = 0; k < TRAVERSE_LANES; ++k) out[k] = predictFlat(nodes, rows + (size_t)k * stride);
+#endif
+}
+
+// 批次預測整個資料集：直接在資料集的列上每次走訪 16 筆；
+// 最後一組可能讀到資料尾端之後，改複製到補齊的緩衝區（不足 16 筆以最後一筆補齊）
+vector<int> predictFlatBatch(const FlatNode* nodes, const Dataset& ds) {
+    vector<int> pred(ds.rows);
+    int label[TRAVERSE_LANES];
+    int i = 0;
+    for (; i + TRAVERSE_LANES < ds.rows; i += TRAVERSE_LANES) {
+        traverse16(nodes, ds.row(i), ds.cols, label);
+        copy(label, label + TRAVERSE_LANES, pred.begin() + i);
+    }
+    if (i < ds.rows) {
+        vector<unsigned char> tail((size_t)TRAVERSE_LANES * ds.cols + 4);
+        for (int k = 0; k < TRAVERSE_LANES; ++k) {
+            memcpy(&tail[(size_t)k * ds.cols], ds.row(min(i + k, ds.rows - 1)), ds.cols);
+        }
+        traverse16(nodes, tail.data(), ds.cols, label);
+        copy(label, label + (ds.rows - i), pred.begin() + i);
+    }
+    return pred;
+}
+
+double compute_macro_f1(const int* true_labels, const vector<int>& pred_labels) {
     int m = 10;
     double macro_f1 = 0.0;
 
     for (int c = 0; c < m; ++c) {
         int TP = 0, FP = 0, FN = 0;
-        for (size_t i = 0; i < true_labels.size(); ++i) {
+        for (size_t i = 0; i < pred_labels.size(); ++i) {
             if (pred_labels[i] == c && true_labels[i] == c) TP++;
             else if (pred_labels[i] == c && true_labels[i] != c) FP++;
             else if (pred_labels[i] != c && true_labels[i] == c) FN++;
@@ -226,134 +919,281 @@ double compute_macro_f1(const vector<int>& true_labels, const vector<int>& pred_
 
     return macro_f1 / m;
 }
-int main() {
+// 以最近排名法取第 p 百分位 (0 ~ 1) 的值：排序後第 ceil(p * n) 筆
+double percentile(vector<double>& v, double p) {
+    if (v.empty()) return 0.0;
+    size_t n = v.size();
+    size_t k = (size_t)max(0.0, ceil(p * n - 1e-9) - 1);
+    k = min(k, n - 1);
+    nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k];
+}
+
+// 印出每筆請求延遲的統計（微秒）與吞吐量
+void reportLatency(ostream& out, vector<double>& latUs, double totalSec) {
+    double mean = latUs.empty() ? 0.0 : accumulate(latUs.begin(), latUs.end(), 0.0) / latUs.size();
+    out << "samples: " << latUs.size() << "\n";
+    out << "latency(us) mean: " << mean
+        << "  p50: " << percentile(latUs, 0.50)
+        << "  p90: " << percentile(latUs, 0.90)
+        << "  p99: " << percentile(latUs, 0.99)
+        << "  max: " << percentile(latUs, 1.0) << "\n";
+    out << "throughput(samples/s): " << (totalSec > 0 ? latUs.size() / totalSec : 0.0) << "\n";
+}
+
+// 評分模式：載入模型後對 CSV 檔或 stdin 逐筆分類
+// 預測結果逐行寫到 stdout，統計資訊寫到 stderr
+// stdin 每列為 numFeatures 個像素值，可選擇性附上標籤；延遲 = 解析 + 預測，不含輸出
+int runScoring(const string& modelFile, const string& inputFile, int nThreads, bool useCache) {
+    FlatModel model;
+    if (!loadModel(modelFile, model)) return 1;
+    using Clock = chrono::steady_clock;
+    vector<double> latUs;
+    vector<int> truth, pred;
+    auto start = Clock::now();
+
+    if (inputFile != "-") {
+        Dataset ds;
+        if (!loadDataset(inputFile, ds, nThreads, useCache)) return 1;
+        if (ds.cols != model.numFeatures) {
+            cerr << "Feature dimension mismatch: model " << model.numFeatures << ", input " << ds.cols << "\n";
+            return 1;
+        }
+        start = Clock::now();
+        latUs.reserve(ds.rows);
+        pred.reserve(ds.rows);
+        for (int i = 0; i < ds.rows; ++i) {
+            auto t0 = Clock::now();
+            int label = predictFlat(model.nodes, ds.row(i));
+            latUs.push_back(chrono::duration<double, micro>(Clock::now() - t0).count());
+            pred.push_back(label);
+        }
+        double totalSec = chrono::duration<double>(Clock::now() - start).count();
+        string out;
+        for (int label : pred) out += to_string(label) + '\n';
+        cout << out;
+        cout.flush();
+        reportLatency(cerr, latUs, totalSec);
+        cerr << "Macro F1 Score: " << compute_macro_f1(ds.y, pred) << "\n";
+        return 0;
+    }
+
+    vector<unsigned char> row(model.numFeatures);
+    string line;
+    bool allLabeled = true;
+    while (getline(cin, line)) {
+        const char* p = line.data();
+        const char* end = p + line.size();
+        if (isBlankLine(p, end)) continue;
+        auto t0 = Clock::now();
+        fill(row.begin(), row.end(), 0);
+        int fields = 0, last = 0;
+        parseValues(p, end, row.data(), model.numFeatures, fields, last);
+        int label = predictFlat(model.nodes, row.data());
+        latUs.push_back(chrono::duration<double, micro>(Clock::now() - t0).count());
+        cout << label << '\n';
+        cout.flush();
+        pred.push_back(label);
+        // 欄位數比特徵多一欄時，最後一欄為標籤
+        if (fields == model.numFeatures + 1) truth.push_back(last);
+        else allLabeled = false;
+    }
+    double totalSec = chrono::duration<double>(Clock::now() - start).count();
+    reportLatency(cerr, latUs, totalSec);
+    if (allLabeled && !truth.empty()) cerr << "Macro F1 Score: " << compute_macro_f1(truth.data(), pred) << "\n";
+    return 0;
+}
+
+// 逐筆量測預測延遲，輸出 JSON 物件（微秒）
+void writeLatencyJson(ostream& out, const Node* root, const Dataset& ds) {
+    vector<double> latUs;
+    latUs.reserve(ds.rows);
+    long long checksum = 0;
+    auto start = ProfClock::now();
+    for (int i = 0; i < ds.rows; ++i) {
+        auto t0 = ProfClock::now();
+        checksum += predict(root, ds.row(i));
+        latUs.push_back(chrono::duration<double, micro>(ProfClock::now() - t0).count());
+    }
+    double totalSec = chrono::duration<double>(ProfClock::now() - start).count();
+    predictSink = checksum;
+    double mean = latUs.empty() ? 0.0 : accumulate(latUs.begin(), latUs.end(), 0.0) / latUs.size();
+    out << "{\"samples\": " << ds.rows
+        << ", \"mean_us\": " << mean
+        << ", \"p50_us\": " << percentile(latUs, 0.50)
+        << ", \"p90_us\": " << percentile(latUs, 0.90)
+        << ", \"p99_us\": " << percentile(latUs, 0.99)
+        << ", \"max_us\": " << percentile(latUs, 1.0)
+        << ", \"samples_per_sec\": " << (totalSec > 0 ? ds.rows / totalSec : 0.0) << "}";
+}
+
+// 將訓練剖析與推論延遲寫成 JSON 報告
+void writeProfile(const string& file, const Node* root, double loadSec, double trainSec,
+                  size_t trainAllocBytes, size_t trainAllocCount) {
+    ofstream out(file);
+    if (!out) {
+        cerr << "Cannot write the profile file: " << file << "\n";
+        return;
+    }
+    long long nodes = accumulate(prof.depthNodes.begin(), prof.depthNodes.end(), 0LL);
+    double phaseSum = prof.histogramSec + prof.sortSec + prof.gainSec + prof.partitionSec;
+    out << setprecision(9);
+    out << "{\n";
+    out << "  \"dataset\": {\"train_rows\": " << trainSet.rows << ", \"test_rows\": " << testSet.rows
+        << ", \"features\": " << numFeatures << ", \"classes\": " << numClasses
+        << ", \"nonzero_density\": "
+        << (double)trainNZ.col.size() / max<size_t>(1, (size_t)trainSet.rows * numFeatures) << "},\n";
+    out << "  \"load_sec\": " << loadSec << ",\n";
+    out << "  \"train\": {\n";
+    out << "    \"total_sec\": " << trainSec << ",\n";
+    out << "    \"nodes\": " << nodes << ",\n";
+    out << "    \"nodes_per_sec\": " << (trainSec > 0 ? nodes / trainSec : 0.0) << ",\n";
+    out << "    \"phases_sec\": {\"histogram\": " << prof.histogramSec << ", \"sort\": " << prof.sortSec
+        << ", \"gain\": " << prof.gainSec << ", \"partition\": " << prof.partitionSec
+        << ", \"other\": " << max(0.0, trainSec - phaseSum) << "},\n";
+    out << "    \"alloc_bytes\": " << trainAllocBytes << ",\n";
+    out << "    \"alloc_count\": " << trainAllocCount << ",\n";
+    out << "    \"by_depth\": [";
+    for (size_t d = 0; d < prof.depthSec.size(); ++d) {
+        out << (d ? ",\n      " : "\n      ")
+            << "{\"depth\": " << d << ", \"nodes\": " << prof.depthNodes[d]
+            << ", \"samples\": " << prof.depthSamples[d] << ", \"sec\": " << prof.depthSec[d] << "}";
+    }
+    out << "\n    ]\n  },\n";
+    out << "  \"inference\": {\n    \"train\": ";
+    writeLatencyJson(out, root, trainSet);
+    out << ",\n    \"test\": ";
+    writeLatencyJson(out, root, testSet);
+    out << "\n  }\n}\n";
+}
+
+int main(int argc, char* argv[]) {
     ios::sync_with_stdio(false);
     cin.tie(NULL);
-    
-    // 檔案名稱，可根據需要修改或使用命令列參數
+
+    // 檔案名稱，可用命令列參數修改：
+    //   --train <file> --test <file>  資料檔
+    //   --threads <n>                 CSV 解析執行緒數
+    //   --cache                       使用 / 建立 <file>.bin 二進位快取
+    //   --model <file>                訓練後輸出的模型檔
+    //   --score <model> [--input <f>] 不訓練，載入模型對 CSV 檔（預設 stdin）評分
+    //   --max-depth <n> --min-samples-split <n> --min-samples-leaf <n> --min-impurity-decrease <x>
+    //                                 預剪枝參數
+    //   --ccp-val <fraction>          保留此比例的訓練資料作為驗證集，做成本複雜度後剪枝
+    //   --profile <file>              輸出訓練各階段耗時與推論延遲的 JSON 報告
     string trainFile = "mnist_train.csv";
     string testFile = "mnist_test.csv";
-    ifstream finTrain(trainFile);
-    if (!finTrain) {
-        cerr << "Cannot open the file: " << trainFile << "\\n";
-        return 1;
-    }
-    ifstream finTest(testFile);
-    if (!finTest) {
-        cerr << "Cannot open the file: " << testFile << "\\n";
-        return 1;
-    }
-
-    // 讀取訓練資料
-    string line;
-    while (getline(finTrain, line)) {
-        if (line.size() == 0) continue;  // 跳過空行
-        string token;
-        stringstream ss(line);
-        vector<int> features;
-        features.reserve(784);
-        // 分割逗號，讀取所有欄位
-        while (getline(ss, token, ',')) {
-            if (token.size() == 0) {
-                // 若有空欄位，視為0
-                features.push_back(0);
-            } else {
-                // 將字串轉成整數
-                features.push_back(stoi(token));
-            }
+    string modelFile = "decision_tree.model";
+    string scoreModel;
+    string inputFile = "-";
+    int nThreads = max(1u, thread::hardware_concurrency());
+    bool useCache = false;
+    double ccpVal = 0.0;
+    string profileFile;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--train" && i + 1 < argc) trainFile = argv[++i];
+        else if (arg == "--test" && i + 1 < argc) testFile = argv[++i];
+        else if (arg == "--threads" && i + 1 < argc) nThreads = max(1, atoi(argv[++i]));
+        else if (arg == "--cache") useCache = true;
+        else if (arg == "--model" && i + 1 < argc) modelFile = argv[++i];
+        else if (arg == "--score" && i + 1 < argc) scoreModel = argv[++i];
+        else if (arg == "--input" && i + 1 < argc) inputFile = argv[++i];
+        else if (arg == "--max-depth" && i + 1 < argc) treeParams.maxDepth = max(0, atoi(argv[++i]));
+        else if (arg == "--min-samples-split" && i + 1 < argc) treeParams.minSamplesSplit = max(2, atoi(argv[++i]));
+        else if (arg == "--min-samples-leaf" && i + 1 < argc) treeParams.minSamplesLeaf = max(1, atoi(argv[++i]));
+        else if (arg == "--min-impurity-decrease" && i + 1 < argc) treeParams.minImpurityDecrease = atof(argv[++i]);
+        else if (arg == "--profile" && i + 1 < argc) profileFile = argv[++i];
+        else if (arg == "--ccp-val" && i + 1 < argc) ccpVal = min(max(atof(argv[++i]), 0.0), 0.9);
+        else {
+            cerr << "Unknown argument: " << arg << "\n";
+            return 1;
         }
-        // 最後一個值為標籤
-        int label = features.back();
-        features.pop_back();
-        // 如果特徵數不足784，補齊0
-        if (features.size() < 784) {
-            features.resize(784, 0);
-        }
-        // 記錄此樣本的特徵和標籤
-        trainFeatures.push_back(features);
-        trainLabels.push_back(label);
     }
-    finTrain.close();
-    // 特徵維度設定為784（或根據第一筆資料長度）
-    if (!trainFeatures.empty()) {
-        numFeatures = trainFeatures[0].size();
-    } else {
-        numFeatures = 784;
+    if (!scoreModel.empty()) return runScoring(scoreModel, inputFile, nThreads, useCache);
+
+    auto loadStart = chrono::high_resolution_clock::now();
+    if (!loadDataset(trainFile, trainSet, nThreads, useCache)) return 1;
+    if (!loadDataset(testFile, testSet, nThreads, useCache)) return 1;
+    chrono::duration<double> loadTime = chrono::high_resolution_clock::now() - loadStart;
+
+    // 特徵維度設定為訓練資料的欄位數（至少 784）
+    numFeatures = trainSet.cols;
+    if (testSet.rows > 0 && testSet.cols != numFeatures) {
+        cerr << "Feature dimension mismatch: train " << numFeatures << ", test " << testSet.cols << "\n";
+        return 1;
     }
     // 推斷類別數量（例如找出最大標籤值）
     int maxLabel = -1;
-    for (int lab : trainLabels) {
-        if (lab > maxLabel) maxLabel = lab;
+    for (int i = 0; i < trainSet.rows; ++i) {
+        if (trainSet.y[i] > maxLabel) maxLabel = trainSet.y[i];
     }
     numClasses = maxLabel + 1;
     if (numClasses < 2) numClasses = 2;  // 至少設定為2類，以防只有單一類別的極端情況
-
-    // 讀取測試資料
-    vector<vector<int>> testFeatures;
-    while (getline(finTest, line)) {
-        if (line.size() == 0) continue;
-        string token;
-        stringstream ss(line);
-        vector<int> features;
-        features.reserve(784);
-        while (getline(ss, token, ',')) {
-            if (token.size() == 0) {
-                features.push_back(0);
-            } else {
-                features.push_back(stoi(token));
-            }
-        }
-        // 最後一個值為標籤
-        int label = features.back();
-        features.pop_back();
-        // 如果特徵數不足784，補齊0
-        if (features.size() < 784) {
-            features.resize(784, 0);
-        }
-        // 記錄此樣本的特徵和標籤
-        testFeatures.push_back(features);
-        testLabels.push_back(label);
-    }
-    finTest.close();
-    // 如未能從訓練資料獲得特徵數，從測試資料設定
-    if (numFeatures == 0 && !testFeatures.empty()) {
-        numFeatures = testFeatures[0].size();
+    if (numClasses > 256) {
+        cerr << "Too many classes: " << numClasses << " (at most 256)\n";  // 分裂搜尋以 8 bits 存標籤
+        return 1;
     }
 
     using namespace chrono;
+    prof.enabled = !profileFile.empty();
+    size_t allocBytesStart = allocBytes.load(), allocCountStart = allocCount.load();
     auto start = high_resolution_clock::now();  // 開始計時
-    // 建構決策樹模型
-    vector<int> allIndices;
-    allIndices.reserve(trainFeatures.size());
-    for (int i = 0; i < (int)trainFeatures.size(); ++i) {
-        allIndices.push_back(i);
+    // 建構決策樹模型；若啟用後剪枝，先以固定種子打亂並切出驗證集
+    vector<int> allIndices(trainSet.rows);
+    iota(allIndices.begin(), allIndices.end(), 0);
+    vector<int> valIndices;
+    if (ccpVal > 0.0) {
+        mt19937 rng(42);
+        shuffle(allIndices.begin(), allIndices.end(), rng);
+        int nVal = (int)(trainSet.rows * ccpVal);
+        valIndices.assign(allIndices.begin(), allIndices.begin() + nVal);
+        allIndices.erase(allIndices.begin(), allIndices.begin() + nVal);
+        sort(allIndices.begin(), allIndices.end());
     }
+    rootSamples = allIndices.size();
+    buildSparseRows(trainSet);
     Node* root = buildTree(allIndices);
 
     auto end = high_resolution_clock::now();    // 結束計時
 	duration<double> duration = end - start;
+    size_t trainAllocBytes = allocBytes.load() - allocBytesStart;
+    size_t trainAllocCount = allocCount.load() - allocCountStart;
+    prof.enabled = false;
+
+    // 成本複雜度後剪枝，並比較剪枝前後的樹大小與預測速度
+    const Dataset& evalSet = testSet.rows > 0 ? testSet : trainSet;
+    double pruneTime = 0.0;
+    if (!valIndices.empty()) {
+        reportTree("Before pruning", root, evalSet);
+        auto pruneStart = high_resolution_clock::now();
+        PruneResult pr = costComplexityPrune(root, valIndices);
+        pruneTime = chrono::duration<double>(high_resolution_clock::now() - pruneStart).count();
+        cout << "Pruning steps: " << pr.steps << ", alpha=" << pr.alpha
+             << ", validation accuracy " << (double)pr.valBefore / valIndices.size()
+             << " -> " << (double)pr.valCorrect / valIndices.size() << endl;
+        reportTree("After pruning", root, evalSet);
+    }
+
+    // 攤平成模型檔的節點格式，批次預測與存檔共用
+    vector<FlatNode> flat;
+    flattenTree(root, flat);
 
     // 對訓練集進行預測並輸出結果
+    trainPred = predictFlatBatch(flat.data(), trainSet);
     ofstream foutTrain("result_train.csv");
-    for (size_t i = 0; i < trainFeatures.size(); ++i) {
-        int predLabel = predict(root, trainFeatures[i]);
-        trainPred.push_back(predLabel);
-        foutTrain << predLabel << "\n";
-    }
+    for (int predLabel : trainPred) foutTrain << predLabel << "\n";
     foutTrain.close();
 
     // 對測試集進行預測並輸出結果
+    testPred = predictFlatBatch(flat.data(), testSet);
     ofstream foutTest("result_test.csv");
-    for (size_t i = 0; i < testFeatures.size(); ++i) {
-        int predLabel = predict(root, testFeatures[i]);
-        testPred.push_back(predLabel);
-        foutTest << predLabel << "\n";
-    }
+    for (int predLabel : testPred) foutTest << predLabel << "\n";
     foutTest.close();
 
     // 計算 Macro F1-score
-    double f1_train = compute_macro_f1(trainLabels, trainPred);
-    double f1_test = compute_macro_f1(testLabels, testPred);
+    double f1_train = compute_macro_f1(trainSet.y, trainPred);
+    double f1_test = compute_macro_f1(testSet.y, testPred);
     cout << "Train Macro F1 Score: " << f1_train << endl;
     cout << "Test  Macro F1 Score: " << f1_test << endl;
 
@@ -365,10 +1205,23 @@ int main() {
     double avgLeafDepth = (double)totalDepth / leafCount;
     cout << "Average leaf depth: " << avgLeafDepth << endl;
     cout << "Node size:" << sizeof(Node) << endl;
-    
+    cout << "Nonzero density: " << (double)trainNZ.col.size() / max<size_t>(1, (size_t)trainSet.rows * numFeatures) << endl;
+
+    // 輸出模型檔，之後可用 --score 直接載入評分
+    if (saveModel(modelFile, flat)) {
+        cout << "Model saved: " << modelFile << " (" << flat.size() * sizeof(FlatNode) << " bytes)" << endl;
+    }
+
+    if (!profileFile.empty()) {
+        writeProfile(profileFile, root, loadTime.count(), duration.count(), trainAllocBytes, trainAllocCount);
+        cout << "Profile saved: " << profileFile << endl;
+    }
+
     deleteTree(root);// 釋放決策樹節點佔用的記憶體
     
+    cout << "loading time: " << loadTime.count() << endl;
     cout << "running time: " << duration.count() << endl;
+    if (!valIndices.empty()) cout << "pruning time: " << pruneTime << endl;
     
 
     return 0;
@@ -68,20 +68,27 @@ double hc(vector<int>& path, const vector<vector<double>>& dist_map, int n, int
 	return cur_dis;
 }
 
-int main()
+int main(int argc, char* argv[])
 {
 	using namespace chrono;
 
 	vector<int> dim = {50, 100, 200, 500, 1000};
+	//可由命令列指定要跑的維度，例如 ./hc 50 100
+	if(argc > 1){
+		dim.clear();
+		for(int i = 1; i < argc; i++) dim.push_back(atoi(argv[i]));
+	}
 
-	//讀取資料
+	//讀取資料，有檔案讀不到時結束碼為 1
+	bool missing = false;
 	for(int D : dim){
 		vector<City> cities;
 
 		string filename = "TSP_Dim=" + to_string(D) + ".txt";
 		ifstream fin(filename);
 		if(!fin){
-			cerr << "Cannot open the file." << endl;
+			cerr << "Cannot open the file: " << filename << endl;
+			missing = true;
 			continue;
 		}
 
@@ -133,4 +140,5 @@ int main()
 		
 		//cout << "completed" << endl;
 	}
+	return missing ? 1 : 0;
 }
\ No newline at end of file
@@ -0,0 +1,422 @@
+/****************  bench.cpp  ****************/
+/* 四個程式（HC、A*、決策樹、隨機森林）共用的效能量測工具：
+   以固定種子產生合成輸入，將程式當作子行程重複執行，記錄牆鐘時間與峰值常駐記憶體，
+   輸出中位數與百分位，可寫成 JSON / CSV，並與先前的 CSV 紀錄比較找出退步 */
+#include <bits/stdc++.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+using namespace std;
+
+using VecS = vector<string>;
+using VecD = vector<double>;
+
+/* ==== 合成輸入 ====
+   檔名與格式和各程式預設讀取的檔案相同，只依 seed 決定內容；檔案已存在時不重新產生，
+   避免更新修改時間而使 .bin / .cols 快取失效。TSP / 3-SAT 產生 dims 指定的維度
+   （預設為程式本身的維度，-- 之後有指定維度時改用指定的） */
+static const vector<int> TSP_DIMS = {50, 100, 200, 500, 1000};
+static const vector<int> SAT_DIMS = {10, 20, 30, 40, 50};
+constexpr int MNIST_TRAIN_ROWS = 6000;
+constexpr int MNIST_TEST_ROWS  = 1000;
+constexpr int MNIST_DIM = 784;
+
+static bool needFile(const string& path){
+    error_code ec;
+    return !filesystem::exists(path,ec);
+}
+
+/* TSP：每行「編號 x y」，座標均勻分布於 [0, 1000) */
+static void genTSP(const string& dir,uint64_t seed,const vector<int>& dims){
+    for(int D:dims){
+        string path = dir + "/TSP_Dim=" + to_string(D) + ".txt";
+        if(!needFile(path)) continue;
+        mt19937_64 rng(seed*1000003 + D);
+        uniform_real_distribution<double> coord(0.0,1000.0);
+        ofstream fout(path);
+        fout << fixed << setprecision(4);
+        for(int i=1;i<=D;++i){
+            double x = coord(rng), y = coord(rng);
+            fout << i << " " << x << " " << y << "\n";
+        }
+    }
+}
+
+/* 3-SAT：每行三個相異變數的字面值（如 "+5, -2, -6"），子句數為 4.26·D；
+   先隨機決定一組解，只保留此解能滿足的子句，保證有解 */
+static void genSAT(const string& dir,uint64_t seed,const vector<int>& dims){
+    for(int D:dims){
+        string path = dir + "/3SAT_Dim=" + to_string(D) + ".csv";
+        if(!needFile(path)) continue;
+        mt19937_64 rng(seed*1000003 + D);
+        vector<int> planted(D+1);
+        for(int v=1;v<=D;++v) planted[v] = rng()&1;
+        int m = (int)lround(4.26*D);
+        ofstream fout(path);
+        for(int c=0;c<m;){
+            int var[3], sign[3];
+            bool sat = false;
+            for(int k=0;k<3;++k){
+                do var[k] = 1 + rng()%D; while((k>0 && var[k]==var[0]) || (k>1 && var[k]==var[1]));
+                sign[k] = rng()&1;
+                sat |= (sign[k]==1) == (planted[var[k]]==1);
+            }
+            if(!sat) continue;
+            for(int k=0;k<3;++k) fout << (k ? ", " : "") << (sign[k] ? "+" : "-") << var[k];
+            fout << "\n";
+            ++c;
+        }
+    }
+}
+
+/* MNIST 形狀：784 個 0..255 像素 + 最後一欄標籤；每個類別有固定的亮點位置，再加上隨機雜訊 */
+static void genMNISTFile(const string& path,int rows,uint64_t seed){
+    if(!needFile(path)) return;
+    mt19937_64 rng(seed);
+    ofstream fout(path);
+    vector<int> px(MNIST_DIM);
+    string line;
+    for(int i=0;i<rows;++i){
+        int label = rng()%10;
+        fill(px.begin(),px.end(),0);
+        for(int k=0;k<60;++k)
+            if(rng()%5 != 0) px[(label*53 + k*3 + rng()%3)%MNIST_DIM] = 100 + rng()%156;
+        for(int k=0;k<60;++k) px[rng()%MNIST_DIM] = 1 + rng()%255;
+        line.clear();
+        for(int v:px){ line += to_string(v); line += ','; }
+        line += to_string(label);
+        fout << line << "\n";
+    }
+}
+static void genMNIST(const string& dir,uint64_t seed,const vector<int>&){
+    genMNISTFile(dir + "/mnist_train.csv",MNIST_TRAIN_ROWS,seed*2+1);
+    genMNISTFile(dir + "/mnist_test.csv" ,MNIST_TEST_ROWS ,seed*2+2);
+}
+
+/* ==== 受測程式 ==== */
+struct Engine {
+    string name;                // 命令列上使用的名稱
+    string bin;                 // 預設執行檔（相對於 --bin-dir）
+    void (*gen)(const string& dir,uint64_t seed,const vector<int>& dims);
+    vector<int> dims;           // 預設維度；非空表示程式參數即為維度
+};
+static const vector<Engine> ENGINES = {
+    {"hc",    "hc",             genTSP,   TSP_DIMS},
+    {"astar", "astar",          genSAT,   SAT_DIMS},
+    {"dt",    "decision_tree",  genMNIST, {}},
+    {"rf",    "random_forest",  genMNIST, {}},
+};
+
+/* ==== 執行與量測 ==== */
+struct RunResult {
+    double seconds = 0;
+    double peakRSSMB = 0;       // 子行程的峰值常駐記憶體，不支援的平台為 0
+    int status = 0;             // 結束碼，非 0 即失敗
+};
+
+/* 在 dir 下執行 cmd，stdout / stderr 寫到 logFile */
+static RunResult runOnce(const string& dir,const VecS& cmd,const string& logFile){
+    RunResult r;
+    auto t0 = chrono::steady_clock::now();
+#ifndef _WIN32
+    pid_t pid = fork();
+    if(pid==0){
+        if(chdir(dir.c_str())!=0) _exit(127);
+        int fd = open(logFile.c_str(),O_WRONLY|O_CREAT|O_TRUNC,0644);
+        if(fd>=0){ dup2(fd,1); dup2(fd,2); close(fd); }
+        vector<char*> argv;
+        for(const auto& a:cmd) argv.push_back(const_cast<char*>(a.c_str()));
+        argv.push_back(nullptr);
+        execv(argv[0],argv.data());
+        _exit(127);
+    }
+    int st = 0;
+    struct rusage ru{};
+    if(pid<0 || wait4(pid,&st,0,&ru)<0){ r.status = -1; return r; }
+    r.seconds = chrono::duration<double>(chrono::steady_clock::now()-t0).count();
+    r.status = WIFEXITED(st) ? WEXITSTATUS(st) : 128 + WTERMSIG(st);
+    r.peakRSSMB = ru.ru_maxrss / 1024.0;    // Linux 以 KB 為單位
+#else
+    string line = "cd /d \"" + dir + "\" &&";
+    for(const auto& a:cmd) line += " \"" + a + "\"";
+    line += " > \"" + logFile + "\" 2>&1";
+    r.status = system(line.c_str());
+    r.seconds = chrono::duration<double>(chrono::steady_clock::now()-t0).count();
+#endif
+    return r;
+}
+
+/* 最近排名法：取排序後第 ceil(p*n) 筆，保證 p99 >= p90 >= 中位數 */
+static double percentile(VecD v,double p){
+    if(v.empty()) return 0.0;
+    size_t n = v.size(), k = (size_t)max(0.0,ceil(p*n-1e-9)-1);
+    k = min(k,n-1);
+    nth_element(v.begin(),v.begin()+k,v.end());
+    return v[k];
+}
+/* 偶數筆時取中間兩筆的平均 */
+static double median(VecD v){
+    if(v.empty()) return 0.0;
+    size_t n = v.size(), k = n/2;
+    nth_element(v.begin(),v.begin()+k,v.end());
+    if(n%2) return v[k];
+    return (v[k] + *max_element(v.begin(),v.begin()+k))/2;
+}
+
+struct BenchResult {
+    string engine, args;
+    int warmup = 0, reps = 0, failures = 0;
+    VecD times;                 // 各次正式量測的秒數（不含暖機）
+    double median = 0, p90 = 0, p99 = 0, minT = 0, maxT = 0, mean = 0;
+    double peakRSSMB = 0;       // 所有量測中的最大值
+};
+
+static BenchResult bench(const Engine& e,const string& bin,const string& dir,
+                         const VecS& extra,int warmup,int reps){
+    BenchResult b;
+    b.engine = e.name; b.warmup = warmup; b.reps = reps;
+    VecS cmd = {bin};
+    cmd.insert(cmd.end(),extra.begin(),extra.end());
+    for(size_t i=0;i<extra.size();++i) b.args += (i ? " " : "") + extra[i];
+    string logFile = e.name + ".log";       // 相對於 dir，只保留最後一次的輸出
+    for(int i=0;i<warmup+reps;++i){
+        RunResult r = runOnce(dir,cmd,logFile);
+        if(i<warmup) continue;
+        if(r.status!=0){ b.failures++; continue; }
+        b.times.push_back(r.seconds);
+        b.peakRSSMB = max(b.peakRSSMB,r.peakRSSMB);
+    }
+    if(!b.times.empty()){
+        b.median = median(b.times);
+        b.p90 = percentile(b.times,0.9);
+        b.p99 = percentile(b.times,0.99);
+        b.minT = *min_element(b.times.begin(),b.times.end());
+        b.maxT = *max_element(b.times.begin(),b.times.end());
+        b.mean = accumulate(b.times.begin(),b.times.end(),0.0)/b.times.size();
+    }
+    return b;
+}
+
+/* ==== 輸出 ==== */
+static string jsonEscape(const string& s){
+    string out;
+    for(char c:s){
+        if(c=='"' || c=='\\') out += '\\';
+        out += c;
+    }
+    return out;
+}
+
+static bool writeJson(const string& file,const string& label,const string& stamp,
+                      const vector<BenchResult>& results){
+    ofstream fout(file);
+    if(!fout){
+        cerr << "Cannot write the JSON file: " << file << "\n";
+        return false;
+    }
+    fout << "{\n  \"label\": \"" << jsonEscape(label) << "\",\n"
+         << "  \"timestamp\": \"" << stamp << "\",\n  \"results\": [\n";
+    for(size_t i=0;i<results.size();++i){
+        const BenchResult& b = results[i];
+        fout << "    {\"engine\": \"" << b.engine << "\", \"args\": \"" << jsonEscape(b.args) << "\""
+             << ", \"warmup\": " << b.warmup << ", \"reps\": " << b.reps << ", \"failures\": " << b.failures
+             << ", \"median_s\": " << b.median << ", \"p90_s\": " << b.p90 << ", \"p99_s\": " << b.p99
+             << ", \"min_s\": " << b.minT << ", \"max_s\": " << b.maxT << ", \"mean_s\": " << b.mean
+             << ", \"peak_rss_mb\": " << b.peakRSSMB << ", \"times_s\": [";
+        for(size_t k=0;k<b.times.size();++k) fout << (k ? ", " : "") << b.times[k];
+        fout << "]}" << (i+1<results.size() ? "," : "") << "\n";
+    }
+    fout << "  ]\n}\n";
+    return (bool)fout;
+}
+
+/* CSV 以附加方式寫入，每次執行一列，作為歷次結果的紀錄；標籤與參數欄以引號包住 */
+static const char* CSV_HEADER =
+    "timestamp,label,engine,args,warmup,reps,failures,median_s,p90_s,p99_s,min_s,max_s,mean_s,peak_rss_mb";
+
+static string csvQuote(const string& s){
+    string out = "\"";
+    for(char c:s){
+        if(c=='"') out += '"';      // 引號重複一次
+        out += c;
+    }
+    return out + "\"";
+}
+
+static bool appendCsv(const string& file,const string& label,const string& stamp,
+                      const vector<BenchResult>& results){
+    bool fresh = needFile(file);
+    ofstream fout(file,ios::app);
+    if(!fout){
+        cerr << "Cannot write the CSV file: " << file << "\n";
+        return false;
+    }
+    if(fresh) fout << CSV_HEADER << "\n";
+    for(const auto& b:results)
+        fout << stamp << "," << csvQuote(label) << "," << b.engine << "," << csvQuote(b.args) << ","
+             << b.warmup << "," << b.reps << "," << b.failures << ","
+             << b.median << "," << b.p90 << "," << b.p99 << ","
+             << b.minT << "," << b.maxT << "," << b.mean << "," << b.peakRSSMB << "\n";
+    return (bool)fout;
+}
+
+static VecS splitCsvLine(const string& line){
+    VecS cells(1);
+    bool quoted = false;
+    for(size_t i=0;i<line.size();++i){
+        char c = line[i];
+        if(c=='"'){
+            if(quoted && i+1<line.size() && line[i+1]=='"'){ cells.back() += '"'; ++i; }
+            else quoted = !quoted;
+        }
+        else if(c==',' && !quoted) cells.emplace_back();
+        else if(c!='\r') cells.back() += c;
+    }
+    return cells;
+}
+
+/* 取基準 CSV 中同程式、同參數的最後一筆中位數；找不到回傳 -1 */
+static double baselineMedian(const string& file,const string& engine,const string& args){
+    ifstream fin(file);
+    string line;
+    double median = -1;
+    getline(fin,line);          // 標頭
+    while(getline(fin,line)){
+        VecS c = splitCsvLine(line);
+        if(c.size()>=8 && c[2]==engine && c[3]==args && stoi(c[6])==0) median = atof(c[7].c_str());
+    }
+    return median;
+}
+
+static string timestamp(){
+    time_t t = time(nullptr);
+    char buf[32];
+    strftime(buf,sizeof(buf),"%Y-%m-%dT%H:%M:%S",localtime(&t));
+    return buf;
+}
+
+static void usage(){
+    cerr << "Usage: bench <hc|astar|dt|rf|all>[,...] [options] [-- engine args]\n"
+            "  (engine args need a single engine; hc,astar may share a list of dimensions)\n"
+            "  --bin <file>        executable (single engine only)\n"
+            "  --bin-dir <dir>     directory of the default executables (default .)\n"
+            "  --dir <dir>         working directory with the generated inputs (default bench_data)\n"
+            "  --seed <n>          seed of the synthetic inputs (default 1)\n"
+            "  --warmup <n>        untimed runs before measuring (default 1)\n"
+            "  --reps <n>          measured runs (default 5)\n"
+            "  --json <file>       write the results as JSON\n"
+            "  --csv <file>        append the results to a CSV history\n"
+            "  --label <text>      label stored with the results (e.g. a commit id)\n"
+            "  --baseline <file>   compare medians with the last matching rows of a CSV history\n"
+            "  --tolerance <x>     allowed slowdown against the baseline (default 0.10)\n"
+            "  --gen-only          only generate the inputs\n";
+}
+
+/* ==== 主程式 ==== */
+int main(int argc,char* argv[]){
+    if(argc<2){ usage(); return 1; }
+    string dir = "bench_data", binDir = ".", bin, jsonFile, csvFile, label, baseline;
+    uint64_t seed = 1;
+    int warmup = 1, reps = 5;
+    double tolerance = 0.10;
+    bool genOnly = false;
+    VecS extra;
+    vector<const Engine*> selected;
+
+    string names = argv[1];
+    stringstream ss(names); string name;
+    while(getline(ss,name,',')){
+        bool found = false;
+        for(const auto& e:ENGINES)
+            if(name=="all" || name==e.name){ selected.push_back(&e); found = true; }
+        if(!found){ cerr << "Unknown engine: " << name << "\n"; usage(); return 1; }
+    }
+    for(int i=2;i<argc;++i){
+        string arg = argv[i];
+        if(arg=="--") { extra.assign(argv+i+1,argv+argc); break; }
+        else if(arg=="--bin" && i+1<argc) bin = argv[++i];
+        else if(arg=="--bin-dir" && i+1<argc) binDir = argv[++i];
+        else if(arg=="--dir" && i+1<argc) dir = argv[++i];
+        else if(arg=="--seed" && i+1<argc) seed = strtoull(argv[++i],nullptr,10);
+        else if(arg=="--warmup" && i+1<argc) warmup = max(0,atoi(argv[++i]));
+        else if(arg=="--reps" && i+1<argc) reps = max(1,atoi(argv[++i]));
+        else if(arg=="--json" && i+1<argc) jsonFile = argv[++i];
+        else if(arg=="--csv" && i+1<argc) csvFile = argv[++i];
+        else if(arg=="--label" && i+1<argc) label = argv[++i];
+        else if(arg=="--baseline" && i+1<argc) baseline = argv[++i];
+        else if(arg=="--tolerance" && i+1<argc) tolerance = atof(argv[++i]);
+        else if(arg=="--gen-only") genOnly = true;
+        else { cerr << "Unknown argument: " << arg << "\n"; usage(); return 1; }
+    }
+    if(!bin.empty() && selected.size()!=1){
+        cerr << "--bin requires exactly one engine\n";
+        return 1;
+    }
+    /* -- 之後的參數會原封不動交給每個選到的程式：多個程式時只允許都吃維度的 hc、astar */
+    if(!extra.empty() && selected.size()>1)
+        for(const Engine* e:selected)
+            if(e->dims.empty()){
+                cerr << "Engine args after -- require a single engine (or only hc,astar dimensions)\n";
+                return 1;
+            }
+
+    error_code ec;
+    filesystem::create_directories(dir,ec);
+    for(const Engine* e:selected){          // 已存在的檔案不重產，dt 與 rf 共用同一組 MNIST 檔
+        vector<int> dims = e->dims;
+        if(!dims.empty() && !extra.empty()){
+            dims.clear();
+            for(const auto& a:extra){
+                char* end;
+                long D = strtol(a.c_str(),&end,10);
+                if(end==a.c_str() || *end || D<=0){
+                    cerr << "Invalid dimension for " << e->name << ": " << a << "\n";
+                    return 1;
+                }
+                dims.push_back(D);
+            }
+        }
+        e->gen(dir,seed,dims);
+    }
+    if(genOnly) return 0;
+
+    vector<BenchResult> results;
+    int regressions = 0, failed = 0;
+    cout << fixed << setprecision(4);
+    for(const Engine* e:selected){
+        string exe = bin.empty() ? binDir + "/" + e->bin : bin;
+        string path = filesystem::absolute(exe,ec).string();
+        if(!filesystem::exists(path,ec)){
+            cerr << "Executable not found: " << exe << "\n";
+            return 1;
+        }
+        BenchResult b = bench(*e,path,dir,extra,warmup,reps);
+        results.push_back(b);
+        cout << setw(6) << left << b.engine << right
+             << " median " << b.median << "s  p90 " << b.p90 << "s  p99 " << b.p99
+             << "s  min " << b.minT << "s  peak RSS " << b.peakRSSMB << " MB";
+        if(b.failures){
+            cout << "  (" << b.failures << "/" << reps << " runs failed, see " << dir << "/" << e->name << ".log)";
+            failed++;
+        }
+        if(!baseline.empty() && !b.times.empty()){
+            double base = baselineMedian(baseline,b.engine,b.args);
+            if(base>0){
+                double ratio = b.median/base;
+                cout << "  vs baseline " << ratio << "x";
+                if(ratio>1+tolerance){ cout << " REGRESSION"; regressions++; }
+            }
+        }
+        cout << "\n";
+    }
+
+    string stamp = timestamp();
+    if(!jsonFile.empty()) writeJson(jsonFile,label,stamp,results);
+    if(!csvFile.empty()) appendCsv(csvFile,label,stamp,results);
+    /* 結束碼：1 為有程式執行失敗，2 為相對基準退步 */
+    if(failed) return 1;
+    return regressions ? 2 : 0;
+}
@@ -1,5 +1,15 @@
 /****************  random_forest.cpp  ****************/
 #include <bits/stdc++.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 using namespace std;
 
 /* ==== 全域常數與別名 ==== */
@@ -15,8 +25,8 @@ struct Node {
     int  label  = -1;
 
     /* 內部節點 */
-    int    feat = -1;
-    double thr  = 0.0;
+    int     feat = -1;
+    uint8_t thr  = 0;           // 像素 <= thr 走左子樹；像素為整數，切點 x.5 訓練時即量化為 x
     Node  *left = nullptr, *right = nullptr;
 };
 /* 取得單棵樹的節點數 */
@@ -37,14 +47,75 @@ static void sumLeafDepth(const Node* n, int depth,
     sumLeafDepth(n->right, depth + 1, totalDepth, leafCnt);
 }
 
-static void freeNode(Node* p){
-    if(!p) return;
-    freeNode(p->left);
-    freeNode(p->right);
-    delete p;
+/* ==== 記憶體統計 ==== */
+/* 以 operator new 計算配置次數，用於確認建樹時每個節點幾乎不再配置記憶體 */
+static atomic<size_t> allocCount{0};
+__attribute__((noinline)) void* operator new(size_t n){
+    allocCount.fetch_add(1, memory_order_relaxed);
+    if(void* p = malloc(n ? n : 1)) return p;
+    throw bad_alloc();
+}
+/* new/delete 皆不內聯，避免 GCC 將 malloc/free 配對誤判為 new/delete 不相符 */
+__attribute__((noinline)) void operator delete(void* p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { free(p); }
+
+/* 行程的峰值常駐記憶體 (MB)，不支援的平台回傳 0 */
+static double peakRSSMB(){
+#ifndef _WIN32
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss / 1024.0;       // Linux 以 KB 為單位
+#else
+    return 0.0;
+#endif
 }
 
 /* ==== 工具函式 ==== */
+/* SplitMix64：由 (seed, 計數器) 推導出彼此獨立的亂數種子 */
+static uint64_t splitmix64(uint64_t x){
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/* 以 nThreads 條執行緒平行執行 job(0..n-1)，工作以原子計數器動態分派 */
+template<class F>
+static void parallelFor(int n,int nThreads,F job){
+    nThreads = max(1, min(nThreads, n));
+    atomic<int> next{0};
+    auto worker = [&](){
+        for(int i; (i = next.fetch_add(1)) < n; ) job(i);
+    };
+    vector<thread> pool;
+    for(int t=1;t<nThreads;++t) pool.emplace_back(worker);
+    worker();
+    for(auto& th:pool) th.join();
+}
+
+/* 提前結束投票：依 order 逐棵累計，當領先類別即使剩餘票全投給第二名也無法被追平時停止，
+   結果與全部投票相同；confidence > 0 時另外在至少 EARLY_MIN_TREES 票後、
+   領先者得票率 ≥ confidence 即停止（近似）。evaluated 回傳實際走訪的樹數 */
+constexpr int EARLY_MIN_TREES = 10;
+template<class F>
+static int earlyExitVote(int T,const int* order,double confidence,F treeVote,int& evaluated){
+    array<int,NUM_CLASSES> vote{}; vote.fill(0);
+    int k=0;
+    while(k<T){
+        vote[treeVote(order ? order[k] : k)]++;
+        ++k;
+        int first=0, second=0;
+        for(int c=0;c<NUM_CLASSES;++c){
+            if(vote[c]>first){ second=first; first=vote[c]; }
+            else if(vote[c]>second) second=vote[c];
+        }
+        if(first > second+(T-k)) break;
+        if(confidence>0 && k>=EARLY_MIN_TREES && first>=confidence*k) break;
+    }
+    evaluated = k;
+    return distance(vote.begin(),max_element(vote.begin(),vote.end()));
+}
+
 double gini(const array<int,NUM_CLASSES>& cnt, int n) {
     if (n==0) return 0.0;
     double g = 1.0;
@@ -56,116 +127,593 @@ double gini(const array<int,NUM_CLASSES>& cnt, int n) {
     return g;
 }
 
+/* 唯讀檔案映射：POSIX 使用 mmap，其他平台退回整檔讀入 */
+struct MappedFile {
+    const char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    vector<char> buf;
+#else
+    void* addr = MAP_FAILED;
+#endif
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    bool open(const string& path){
+#ifdef _WIN32
+        ifstream fin(path, ios::binary);
+        if(!fin) return false;
+        buf.assign(istreambuf_iterator<char>(fin), istreambuf_iterator<char>());
+        data = buf.data(); size = buf.size();
+        return true;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd<0) return false;
+        struct stat st;
+        if(fstat(fd,&st)!=0){ ::close(fd); return false; }
+        size = st.st_size;
+        if(size>0){
+            addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            if(addr==MAP_FAILED){ ::close(fd); return false; }
+            data = (const char*)addr;
+        }
+        ::close(fd);
+        return true;
+#endif
+    }
+    ~MappedFile(){
+#ifndef _WIN32
+        if(addr!=MAP_FAILED) munmap(addr, size);
+#endif
+    }
+};
+
+/* ==== 共用特徵索引 ==== */
+/* 建樹前將每個特徵分箱一次，以行優先 (column-major) 的 uint8 存放，所有樹與執行緒唯讀共用；
+   MNIST 像素即為 0..255，分箱值就是原值，閾值與原本逐值排序時相同。
+   資料可由記憶體中的矩陣建立，或 mmap 唯讀映射磁碟上的欄式檔（見 buildColumnFile），
+   後者只有建樹時實際讀到的欄位分頁會載入，可由作業系統換出 */
+constexpr int NUM_BINS = 256;
+struct BinnedFeatures {
+    int rows = 0;
+    const uint8_t* bins = nullptr;  // FEATURE_DIM × rows
+    BinnedFeatures() = default;
+    BinnedFeatures(const BinnedFeatures&) = delete;
+    BinnedFeatures& operator=(const BinnedFeatures&) = delete;
+    void build(const MatI& X){
+        rows = X.size();
+        owned.resize((size_t)FEATURE_DIM*rows);
+        for(int i=0;i<rows;++i)
+            for(int f=0;f<FEATURE_DIM;++f)
+                owned[(size_t)f*rows+i] = (uint8_t)min(max(X[i][f],0),NUM_BINS-1);
+        bins = owned.data();
+    }
+    /* 映射欄式檔的分箱區段，offset 為其在檔案中的位置 */
+    bool map(const string& file,int n,size_t offset){
+        if(!mf.open(file) || mf.size < offset+(size_t)FEATURE_DIM*n) return false;
+        rows = n;
+        bins = (const uint8_t*)mf.data + offset;
+        return true;
+    }
+    const uint8_t* col(int f) const { return bins+(size_t)f*rows; }
+    /* 取出第 i 筆樣本（逐欄讀取，只用於單筆預測） */
+    void row(int i,VecI& x) const{
+        x.resize(FEATURE_DIM);
+        for(int f=0;f<FEATURE_DIM;++f) x[f] = col(f)[i];
+    }
+private:
+    vector<uint8_t> owned;
+    MappedFile mf;
+};
+
 /* ==== 決策樹 ==== */
+/* 分裂方式：Best 為評估所有切點；Random 為 Extra-Trees，每個候選特徵只隨機取一個切點 */
+enum class SplitMode { Best, Random };
+
+/* 每條執行緒一份的建樹暫存區，同一執行緒上建的各棵樹重複使用，節點層級不需再配置記憶體 */
+struct TrainScratch {
+    VecI index;                 // 本棵樹的袋內樣本索引，子節點在此陣列上就地切分
+    VecI partBuf;               // 穩定切分時暫放右側索引
+    VecI subset;                // 大節點抽樣
+    VecI featPool;              // 特徵池，部分 Fisher–Yates 只洗前 maxFeatures 個
+    vector<uint16_t> weight;    // 各樣本的 bootstrap 抽中次數，0 即為袋外
+    array<array<int,NUM_CLASSES>,NUM_BINS> hist{};      // 分裂搜尋用直方圖，掃描後即清零
+    array<int,NUM_BINS> binTotal{};
+};
+static TrainScratch& threadScratch(){
+    static thread_local TrainScratch ws;
+    return ws;
+}
+
+/* 節點以區塊配置，每次配置 NODE_BLOCK 個，整棵樹隨 DecisionTree 一起釋放 */
+class NodeArena {
+public:
+    Node* alloc(){
+        if(used==NODE_BLOCK){
+            blocks.push_back(make_unique<Node[]>(NODE_BLOCK));
+            used = 0;
+        }
+        return &blocks.back()[used++];
+    }
+private:
+    static constexpr int NODE_BLOCK = 1024;
+    vector<unique_ptr<Node[]>> blocks;
+    int used = NODE_BLOCK;
+};
+
 class DecisionTree {
 public:
-    DecisionTree(int maxDepth,int minLeaf,int maxFeat,
-                 mt19937& rng,const MatI& X,const VecI& y)
+    /* 每棵樹持有自己的亂數引擎，結果只取決於種子，與建樹順序或執行緒數無關 */
+    DecisionTree(int maxDepth,int minLeaf,int maxFeat,SplitMode mode,int maxSplitRows,
+                 uint64_t seed,const VecI& y,const BinnedFeatures& B)
         : depthLimit(maxDepth), minLeafSize(minLeaf), maxFeatures(maxFeat),
-          rnd(rng), Xref(X), yref(y) {}
+          splitMode(mode), maxSplitRows(maxSplitRows),
+          rnd((mt19937::result_type)seed), yref(y), binned(B) {}
+
+    /* bootstrap 抽樣後建樹；每個樣本只出現一次，以抽中次數作為權重（0 即袋外），
+       建樹後順便預測袋外 (OOB) 樣本：oobPred[i] 為預測類別，袋內樣本為 -1 */
+    Node* fitBootstrap(VecI& oobPred){
+        ws = &threadScratch();
+        size_t n = binned.rows;
+        uniform_int_distribution<int> uni(0,n-1);
+        ws->weight.assign(n,0);
+        for(size_t i=0;i<n;++i) ws->weight[uni(rnd)]++;
+        ws->index.clear();
+        for(size_t i=0;i<n;++i) if(ws->weight[i]) ws->index.push_back(i);
+        ws->partBuf.resize(ws->index.size());
+        ws->featPool.resize(FEATURE_DIM);
+        iota(ws->featPool.begin(),ws->featPool.end(),0);   // 每棵樹從相同狀態開始，結果與執行緒分派無關
+        importance.assign(FEATURE_DIM,0.0);
+        Node* root = build(0,ws->index.size());
+        oobPred.assign(n,-1);
+        for(size_t i=0;i<n;++i)
+            if(!ws->weight[i]) oobPred[i] = predict(root,binned,i);
+        ws = nullptr;
+        return root;
+    }
+    /* 此樹各特徵的加權 Gini 下降總和 Σ n_t·gain */
+    const VecD& featureImportance() const { return importance; }
 
-    Node* build(const VecI& idx,int depth=0) {
-        Node* node = new Node();
-        int n = idx.size();
-        /* 類別計數 */
+    /* 以 ws->index[lo, hi) 的樣本建子樹 */
+    Node* build(int lo,int hi,int depth=0) {
+        Node* node = nodes.alloc();
+        int* ids = ws->index.data()+lo;
+        int m = hi-lo;
+        const uint16_t* weight = ws->weight.data();
+        /* 類別計數（依 bootstrap 抽中次數加權），n 為加權後樣本數 */
         array<int,NUM_CLASSES> cnt{}; cnt.fill(0);
-        for(int id:idx) cnt[yref[id]]++;
+        int n = 0;
+        for(int k=0;k<m;++k){ cnt[yref[ids[k]]] += weight[ids[k]]; n += weight[ids[k]]; }
         /* 若樣本屬同類或達深度/葉大小門檻 → 葉節點 */
         int majority = distance(cnt.begin(),
                          max_element(cnt.begin(),cnt.end()));
         if (depth>=depthLimit || n<=minLeafSize || cnt[majority]==n){
             node->leaf=true; node->label=majority; return node;
         }
-        double parentGini = gini(cnt,n);
+        /* 大節點只在隨機抽出的 maxSplitRows 筆樣本上搜尋分裂（切分時仍用全部樣本） */
+        const int* search = ids;
+        int searchM = m;
+        array<int,NUM_CLASSES> searchCnt = cnt;
+        int searchN = n;
+        if(maxSplitRows>0 && m>maxSplitRows){
+            VecI& subset = ws->subset;
+            subset.assign(ids,ids+m);
+            for(int k=0;k<maxSplitRows;++k){
+                uniform_int_distribution<int> pick(k,m-1);
+                swap(subset[k],subset[pick(rnd)]);
+            }
+            subset.resize(maxSplitRows);
+            sort(subset.begin(),subset.end());      // 依索引遞增讀取欄位，維持循序存取
+            searchCnt.fill(0); searchN = 0;
+            for(int id:subset){ searchCnt[yref[id]] += weight[id]; searchN += weight[id]; }
+            search = subset.data();
+            searchM = maxSplitRows;
+        }
+        double parentGini = gini(searchCnt,searchN);
 
-        /* 隨機抽 maxFeatures 個特徵 */
-        vector<int> featPool(FEATURE_DIM);
-        iota(featPool.begin(),featPool.end(),0);
-        shuffle(featPool.begin(),featPool.end(),rnd);
-        featPool.resize(maxFeatures);
+        /* 隨機抽 maxFeatures 個特徵：部分 Fisher–Yates，只洗前 maxFeatures 個位置 */
+        int* featPool = ws->featPool.data();
+        for(int k=0;k<maxFeatures;++k){
+            uniform_int_distribution<int> pick(k,FEATURE_DIM-1);
+            swap(featPool[k],featPool[pick(rnd)]);
+        }
 
         /* 搜最佳分裂 */
-        double bestGain=0; int bestF=-1; double bestThr=0;
-        VecI bestLeft,bestRight;
-
-        for(int f:featPool){
-            /* 蒐集(值,idx)並排序 */
-            vector<pair<int,int>> vals;
-            vals.reserve(n);
-            for(int id:idx) vals.emplace_back(Xref[id][f], id);
-            sort(vals.begin(),vals.end());
-
-            array<int,NUM_CLASSES> leftCnt{}; leftCnt.fill(0);
-            array<int,NUM_CLASSES> rightCnt = cnt;
-            int nl=0,nr=n;
-
-            for(int i=0;i<n-1;++i){
-                int id = vals[i].second;
-                int lab= yref[id];
-                leftCnt[lab]++;  rightCnt[lab]--;
-                nl++; nr--;
-                if(vals[i].first==vals[i+1].first) continue; // 值相同不切
-
-                double gl = gini(leftCnt,nl);
-                double gr = gini(rightCnt,nr);
-                double gain = parentGini - ((double)nl/n)*gl - ((double)nr/n)*gr;
-                if(gain>bestGain){
-                    bestGain=gain; bestF=f;
-                    bestThr=(vals[i].first+vals[i+1].first)/2.0;
-                }
-            }
+        Split best;
+        for(int k=0;k<maxFeatures;++k){
+            int f = featPool[k];
+            if(splitMode==SplitMode::Random) randomSplit(f,search,searchM,searchCnt,searchN,parentGini,best);
+            else                             bestSplit  (f,search,searchM,searchCnt,searchN,parentGini,best);
         }
         /* 若無有效分裂→葉節點 */
-        if(bestF==-1 || bestGain<=1e-7){
+        if(best.feat==-1 || best.gain<=1e-7){
             node->leaf=true; node->label=majority; return node;
         }
 
-        /* 生成左右索引 */
-        VecI leftIdx,rightIdx;
-        leftIdx.reserve(idx.size());
-        rightIdx.reserve(idx.size());
-        for(int id:idx){
-            if(Xref[id][bestF]<=bestThr) leftIdx.push_back(id);
-            else                         rightIdx.push_back(id);
+        /* 就地穩定切分：左側樣本前移，右側樣本暫存後接在後面 */
+        const uint8_t* bestCol = binned.col(best.feat);
+        int* right = ws->partBuf.data();
+        int nl=0, nr=0;
+        for(int k=0;k<m;++k){
+            int id = ids[k];
+            if(bestCol[id]<=best.thr) ids[nl++] = id;
+            else                      right[nr++] = id;
         }
+        copy(right,right+nr,ids+nl);
 
-        node->feat=bestF; node->thr=bestThr;
-        node->left = build(leftIdx, depth+1);
-        node->right= build(rightIdx,depth+1);
+        importance[best.feat] += n*best.gain;
+        node->feat=best.feat; node->thr=best.thr;
+        node->left = build(lo,lo+nl,depth+1);
+        node->right= build(lo+nl,hi,depth+1);
         return node;
     }
-    int predict(Node* node,const VecI& x) const{
+    int predict(const Node* node,const VecI& x) const{
         const Node* cur=node;
         while(!cur->leaf){
             cur = (x[cur->feat]<=cur->thr)?cur->left:cur->right;
         }
         return cur->label;
     }
+    /* 直接以分箱資料的第 i 筆預測（袋外樣本），不需原始矩陣 */
+    int predict(const Node* node,const BinnedFeatures& B,int i) const{
+        const Node* cur=node;
+        while(!cur->leaf){
+            cur = (B.col(cur->feat)[i]<=cur->thr)?cur->left:cur->right;
+        }
+        return cur->label;
+    }
 private:
+    struct Split {
+        double gain = 0; int feat = -1; int thr = 0;
+    };
+    /* 在切點 thr 下評估 Gini 增益，優於目前最佳時更新 */
+    static void consider(Split& best,int f,int thr,double parentGini,int n,
+                         const array<int,NUM_CLASSES>& leftCnt,int nl,
+                         const array<int,NUM_CLASSES>& rightCnt,int nr){
+        double gl = gini(leftCnt,nl);
+        double gr = gini(rightCnt,nr);
+        double gain = parentGini - ((double)nl/n)*gl - ((double)nr/n)*gr;
+        if(gain>best.gain){
+            best.gain=gain; best.feat=f; best.thr=thr;
+        }
+    }
+    /* 精確搜尋：以直方圖累計各分箱的加權類別次數（取代排序），評估所有相鄰非空分箱間的切點 */
+    void bestSplit(int f,const int* ids,int m,const array<int,NUM_CLASSES>& cnt,int n,
+                   double parentGini,Split& best){
+        const uint8_t* col = binned.col(f);
+        const uint16_t* weight = ws->weight.data();
+        auto& hist = ws->hist;
+        auto& binTotal = ws->binTotal;
+        for(int k=0;k<m;++k){
+            int id = ids[k], b = col[id], w = weight[id];
+            hist[b][yref[id]] += w;
+            binTotal[b] += w;
+        }
+
+        array<int,NUM_CLASSES> leftCnt{}; leftCnt.fill(0);
+        array<int,NUM_CLASSES> rightCnt = cnt;
+        int nl=0,nr=n;
+
+        /* 由小到大掃描非空分箱，切點在相鄰兩個非空分箱之間；用完即清零供下一個特徵使用 */
+        int prev=-1;
+        for(int b=0;b<NUM_BINS;++b){
+            if(binTotal[b]==0) continue;
+            if(prev>=0) consider(best,f,(prev+b)/2,parentGini,n,leftCnt,nl,rightCnt,nr);   // 即中點 (prev+b)/2.0 的下取整
+            for(int c=0;c<NUM_CLASSES;++c){
+                leftCnt[c]  += hist[b][c];
+                rightCnt[c] -= hist[b][c];
+            }
+            nl += binTotal[b]; nr -= binTotal[b];
+            hist[b].fill(0); binTotal[b]=0;
+            prev=b;
+        }
+    }
+    /* Extra-Trees：在此節點該特徵的 [min, max) 間隨機取一個切點，只需求極值與一次計數 */
+    void randomSplit(int f,const int* ids,int m,const array<int,NUM_CLASSES>& cnt,int n,
+                     double parentGini,Split& best){
+        const uint8_t* col = binned.col(f);
+        const uint16_t* weight = ws->weight.data();
+        int lo = NUM_BINS, hi = -1;
+        for(int k=0;k<m;++k){
+            lo = min(lo,(int)col[ids[k]]);
+            hi = max(hi,(int)col[ids[k]]);
+        }
+        if(lo>=hi) return;                          // 常數特徵無法分裂
+        uniform_int_distribution<int> cut(lo,hi-1);
+        int thr = cut(rnd);                         // 切點 thr + 0.5
+
+        array<int,NUM_CLASSES> leftCnt{}; leftCnt.fill(0);
+        int nl=0;
+        for(int k=0;k<m;++k){
+            int id = ids[k];
+            if(col[id]<=thr){ leftCnt[yref[id]] += weight[id]; nl += weight[id]; }
+        }
+        array<int,NUM_CLASSES> rightCnt;
+        for(int c=0;c<NUM_CLASSES;++c) rightCnt[c] = cnt[c]-leftCnt[c];
+        consider(best,f,thr,parentGini,n,leftCnt,nl,rightCnt,n-nl);
+    }
+
     int  depthLimit, minLeafSize, maxFeatures;
-    mt19937& rnd;
-    const MatI& Xref; const VecI& yref;
+    SplitMode splitMode;
+    int  maxSplitRows;                                  // 0 表示不抽樣
+    mt19937 rnd;
+    const VecI& yref;
+    const BinnedFeatures& binned;
+    TrainScratch* ws = nullptr;                         // 建樹期間使用的執行緒暫存區
+    NodeArena nodes;
+    VecD importance;
+};
+
+/* ==== 模型檔 ====
+   所有樹以前序攤平後串接在同一個連續陣列：左子節點為 i+1，只記右子節點（全域索引），
+   treeOffset[t] 為第 t 棵樹的根。檔案 = 檔頭 + (T+1) 個 uint32 偏移 + 節點陣列，
+   以 mmap 唯讀共享映射載入，多個行程可共用同一份頁快取 */
+struct PackedNode {             // 8 bytes，兩個 32 位元字可各用一次 gather 取得
+    int32_t  next;              // 內部節點：右子節點索引；葉節點：類別
+    uint16_t feat;              // LEAF_FEAT 表示葉節點
+    uint8_t  thr;               // 像素 <= thr 走左子樹
+    uint8_t  pad;
+};
+constexpr uint16_t LEAF_FEAT = 0xFFFF;
+struct ModelHeader {
+    char    magic[8];           // "RFMODEL\0"
+    int32_t version;
+    int32_t numTrees;
+    int32_t featureDim;
+    int32_t numClasses;
+    int32_t nodeCount;
+    int32_t reserved;
+};
+static const char MODEL_MAGIC[8] = {'R','F','M','O','D','E','L','\0'};
+constexpr int32_t MODEL_VERSION = 2;         // 2：閾值量化為 uint8，節點 8 bytes
+
+static void flattenTree(const Node* n, vector<PackedNode>& out){
+    int self = out.size();
+    out.push_back({n->label, n->leaf ? LEAF_FEAT : (uint16_t)n->feat, n->thr, 0});
+    if(n->leaf) return;
+    flattenTree(n->left, out);
+    out[self].next = out.size();
+    flattenTree(n->right, out);
+}
+
+/* 16 筆樣本同時走訪一棵樹，out[k] 為第 k 筆的類別。rows 為 16 筆連續的 uint8 樣本，每筆 stride bytes，
+   最後一筆之後至少還有 3 bytes 可讀（gather 一次讀 4 bytes 再取低位元組）。
+   AVX2：兩組各 8 個通道交錯執行以重疊 gather 延遲；每層以 gather 取節點與像素，比較後以 blend 選子節點，
+   已到葉節點的通道停在原地，全部到葉節點才離開迴圈，樣本間不需分支。未啟用 AVX2 時逐筆走訪 */
+constexpr int TRAVERSE_LANES = 16;
+#ifdef __AVX2__
+struct LaneGroup {
+    __m256i idx, next, leaf;
+};
+/* 讀取目前節點；已全部到葉節點時回傳 true，否則前進一層 */
+static inline bool laneStep(const int* words,const uint8_t* rows,__m256i laneOff,LaneGroup& g){
+    const __m256i low8 = _mm256_set1_epi32(0xFF);
+    g.next = _mm256_i32gather_epi32(words,g.idx,8);
+    __m256i info = _mm256_i32gather_epi32(words+1,g.idx,8);           // feat | thr<<16
+    __m256i feat = _mm256_and_si256(info,_mm256_set1_epi32(0xFFFF));
+    g.leaf = _mm256_cmpeq_epi32(feat,_mm256_set1_epi32(LEAF_FEAT));
+    if(_mm256_movemask_epi8(g.leaf)==-1) return true;
+    __m256i thr = _mm256_and_si256(_mm256_srli_epi32(info,16),low8);
+    __m256i off = _mm256_add_epi32(laneOff,_mm256_andnot_si256(g.leaf,feat));
+    __m256i x = _mm256_and_si256(_mm256_i32gather_epi32((const int*)rows,off,1),low8);
+    __m256i child = _mm256_blendv_epi8(_mm256_add_epi32(g.idx,_mm256_set1_epi32(1)),g.next,
+                                       _mm256_cmpgt_epi32(x,thr));
+    g.idx = _mm256_blendv_epi8(child,g.idx,g.leaf);
+    return false;
+}
+#endif
+static inline void traverse16(const PackedNode* nodes,int root,const uint8_t* rows,int stride,int* out){
+#ifdef __AVX2__
+    const int* words = (const int*)nodes;
+    const __m256i lane = _mm256_mullo_epi32(_mm256_setr_epi32(0,1,2,3,4,5,6,7),_mm256_set1_epi32(stride));
+    const __m256i laneHi = _mm256_add_epi32(lane,_mm256_set1_epi32(8*stride));
+    LaneGroup a, b;
+    a.idx = b.idx = _mm256_set1_epi32(root);
+    bool doneA = false, doneB = false;
+    while(!(doneA && doneB)){
+        if(!doneA) doneA = laneStep(words,rows,lane,a);
+        if(!doneB) doneB = laneStep(words,rows,laneHi,b);
+    }
+    _mm256_storeu_si256((__m256i*)out,a.next);
+    _mm256_storeu_si256((__m256i*)(out+8),b.next);
+#else
+    for(int k=0;k<TRAVERSE_LANES;++k){
+        const uint8_t* x = rows + (size_t)k*stride;
+        int i = root;
+        while(nodes[i].feat!=LEAF_FEAT)
+            i = (x[nodes[i].feat]<=nodes[i].thr) ? i+1 : nodes[i].next;
+        out[k] = nodes[i].next;
+    }
+#endif
+}
+
+/* 批次預測：樣本切成 BLOCK 筆一組，先以 fillRow(i, dst) 轉成 uint8 列優先緩衝區，
+   組內以「樹為外層」走訪，同一棵樹的節點在整組樣本間保持在快取中，每次 traverse16 走 16 筆；
+   各組由執行緒平行處理。不足 16 筆的尾端以最後一筆補齊，結果捨棄 */
+template<class F>
+static VecI packedBatchVote(const PackedNode* nodes,const uint32_t* offset,int T,int n,int threads,F fillRow){
+    constexpr int BLOCK = 256;
+    VecI out(n);
+    parallelFor((n+BLOCK-1)/BLOCK,threads,[&](int b){
+        int lo = b*BLOCK, m = min(n-lo, BLOCK);
+        int padded = (m+TRAVERSE_LANES-1)/TRAVERSE_LANES*TRAVERSE_LANES;
+        vector<uint8_t> rows((size_t)padded*FEATURE_DIM + 4);
+        for(int k=0;k<padded;++k) fillRow(lo+min(k,m-1),&rows[(size_t)k*FEATURE_DIM]);
+        array<array<int,NUM_CLASSES>,BLOCK> vote{};
+        int label[TRAVERSE_LANES];
+        for(int t=0;t<T;++t)
+            for(int k=0;k<m;k+=TRAVERSE_LANES){
+                traverse16(nodes,offset[t],&rows[(size_t)k*FEATURE_DIM],FEATURE_DIM,label);
+                for(int j=0;j<TRAVERSE_LANES && k+j<m;++j) vote[k+j][label[j]]++;
+            }
+        for(int k=0;k<m;++k){
+            auto& v = vote[k];
+            out[lo+k] = distance(v.begin(),max_element(v.begin(),v.end()));
+        }
+    });
+    return out;
+}
+/* 將一筆原始樣本轉成 uint8；超出 0..255 的像素截斷後與量化閾值比較的結果不變 */
+static void packRow(const VecI& x,uint8_t* dst){
+    for(int f=0;f<FEATURE_DIM;++f) dst[f] = (uint8_t)min(max(x[f],0),255);
+}
+
+/* 從模型檔載入的森林，只做預測 */
+class ForestModel {
+public:
+    bool load(const string& file){
+        if(!mf.open(file)){
+            cerr << "Cannot open the model file: " << file << "\n";
+            return false;
+        }
+        ModelHeader h;
+        bool ok = mf.size >= sizeof(h);
+        if(ok){
+            memcpy(&h, mf.data, sizeof(h));
+            ok = memcmp(h.magic, MODEL_MAGIC, 8)==0 && h.version==MODEL_VERSION
+              && h.featureDim==FEATURE_DIM && h.numClasses==NUM_CLASSES && h.numTrees>0 && h.nodeCount>0
+              && mf.size == sizeof(h) + (size_t)(h.numTrees+1)*sizeof(uint32_t) + (size_t)h.nodeCount*sizeof(PackedNode);
+        }
+        if(ok){
+            T = h.numTrees;
+            offset = (const uint32_t*)(mf.data + sizeof(h));
+            nodes  = (const PackedNode*)(mf.data + sizeof(h) + (size_t)(T+1)*sizeof(uint32_t));
+            ok = validate(h.nodeCount);
+        }
+        if(!ok) cerr << "Invalid model file: " << file << "\n";
+        return ok;
+    }
+    int numTrees() const { return T; }
+    int treePredict(int t,const VecI& x) const{
+        int i = offset[t];
+        while(nodes[i].feat!=LEAF_FEAT)
+            i = (x[nodes[i].feat]<=nodes[i].thr) ? i+1 : nodes[i].next;
+        return nodes[i].next;
+    }
+    int predict(const VecI& x) const{
+        array<int,NUM_CLASSES> vote{}; vote.fill(0);
+        for(int t=0;t<T;++t) vote[treePredict(t,x)]++;
+        return distance(vote.begin(),max_element(vote.begin(),vote.end()));
+    }
+    /* 模型檔中的樹已依 OOB 準確率排序，直接依檔案順序提前結束投票 */
+    int predictEarly(const VecI& x,double confidence,int& evaluated) const{
+        return earlyExitVote(T,nullptr,confidence,[&](int t){ return treePredict(t,x); },evaluated);
+    }
+    VecI predictBatch(const MatI& X,int threads) const{
+        return packedBatchVote(nodes,offset,T,X.size(),threads,
+                               [&](int i,uint8_t* dst){ packRow(X[i],dst); });
+    }
+private:
+    /* 檢查偏移與子節點索引都在該樹範圍內且只往後指，之後走訪不需邊界檢查 */
+    bool validate(int nodeCount) const{
+        if(offset[0]!=0 || offset[T]!=(uint32_t)nodeCount) return false;
+        for(int t=0;t<T;++t){
+            int lo = offset[t], hi = offset[t+1];
+            if(lo>=hi) return false;
+            for(int i=lo;i<hi;++i){
+                const PackedNode& p = nodes[i];
+                bool ok = p.feat==LEAF_FEAT ? (p.next>=0 && p.next<NUM_CLASSES)
+                                            : (p.feat<FEATURE_DIM && i+1<hi && p.next>i+1 && p.next<hi);
+                if(!ok) return false;
+            }
+        }
+        return true;
+    }
+    MappedFile mf;
+    int T = 0;
+    const uint32_t* offset = nullptr;
+    const PackedNode* nodes = nullptr;
 };
 
 /* ==== Random Forest ==== */
 class RandomForest {
 public:
-    RandomForest(int nTrees,int maxDepth,int minLeaf,int maxFeat)
-        : T(nTrees), depth(maxDepth), minLeaf(minLeaf), maxFeat(maxFeat) {}
+    /* mode / maxSplitRows：分裂方式與大節點搜尋分裂時的抽樣筆數（0 為不抽樣） */
+    RandomForest(int nTrees,int maxDepth,int minLeaf,int maxFeat,
+                 SplitMode mode=SplitMode::Best,int maxSplitRows=0,
+                 int nThreads=max(1u,thread::hardware_concurrency()),uint64_t seed=42)
+        : T(nTrees), depth(maxDepth), minLeaf(minLeaf), maxFeat(maxFeat),
+          mode(mode), maxSplitRows(maxSplitRows), threads(nThreads), seed(seed) {}
+    RandomForest(const RandomForest&) = delete;
+    RandomForest& operator=(const RandomForest&) = delete;
+    /* 節點由各樹的 NodeArena 持有，隨 trees 一起釋放 */
 
+    /* 各樹以 splitmix64(seed, t) 取得獨立亂數流，平行建樹結果與執行緒數無關 */
     void fit(const MatI& X,const VecI& y){
-        rng.seed(42);
-        uniform_int_distribution<int> uni(0,X.size()-1);
-        for(int t=0;t<T;++t){
-            /* bootstrap 樣本索引 */
-            VecI sampleIdx;
-            sampleIdx.reserve(X.size());
-            for(size_t i=0;i<X.size();++i) sampleIdx.push_back(uni(rng));
-
-            DecisionTree tree(depth,minLeaf,maxFeat,rng,X,y);
-            roots.push_back(tree.build(sampleIdx));
-            trees.push_back(std::move(tree));
+        binned.build(X);            // 所有樹共用，只分箱一次
+        fit(binned,y);
+    }
+    /* 以已分箱的資料建樹（可為 mmap 的欄式檔）；B 需在 fit 期間保持有效 */
+    void fit(const BinnedFeatures& B,const VecI& y){
+        trees.clear();
+        trees.reserve(T);
+        for(int t=0;t<T;++t)
+            trees.emplace_back(depth,minLeaf,maxFeat,mode,maxSplitRows,splitmix64(seed+t),y,B);
+        roots.assign(T,nullptr);
+        /* OOB 投票為整數加總，與合併順序無關 */
+        oobVotes.assign(B.rows,{});
+        mutex voteLock;
+        VecD oobAcc(T,0.0);
+        parallelFor(T,threads,[&](int t){
+            VecI oobPred;
+            roots[t] = trees[t].fitBootstrap(oobPred);
+            int hit=0, total=0;
+            for(size_t i=0;i<oobPred.size();++i)
+                if(oobPred[i]>=0){ ++total; hit += oobPred[i]==y[i]; }
+            oobAcc[t] = total ? (double)hit/total : 0.0;
+            lock_guard<mutex> lk(voteLock);
+            for(size_t i=0;i<oobPred.size();++i)
+                if(oobPred[i]>=0) oobVotes[i][oobPred[i]]++;
+        });
+        /* 提前結束投票的樹順序：OOB 準確率高的樹先投，較快形成決定性多數 */
+        order.resize(T);
+        iota(order.begin(),order.end(),0);
+        stable_sort(order.begin(),order.end(),[&](int a,int b){ return oobAcc[a]>oobAcc[b]; });
+        /* 特徵重要度：各樹先正規化為總和 1，再依樹的順序平均 */
+        importances.assign(FEATURE_DIM,0.0);
+        for(const auto& tree:trees){
+            const VecD& imp = tree.featureImportance();
+            double sum = accumulate(imp.begin(),imp.end(),0.0);
+            if(sum<=0) continue;
+            for(int f=0;f<FEATURE_DIM;++f) importances[f] += imp[f]/sum/T;
+        }
+        /* 攤平成模型檔的節點格式，供批次預測與存檔使用 */
+        packed.clear(); offset.clear();
+        for(int t:order){
+            offset.push_back(packed.size());
+            flattenTree(roots[t],packed);
+        }
+        offset.push_back(packed.size());
+    }
+    /* 各樣本的 OOB 多數決預測，從未落在袋外的樣本為 -1 */
+    VecI oobPredict() const{
+        VecI out(oobVotes.size(),-1);
+        for(size_t i=0;i<oobVotes.size();++i){
+            const auto& v = oobVotes[i];
+            auto it = max_element(v.begin(),v.end());
+            if(*it>0) out[i] = distance(v.begin(),it);
         }
+        return out;
+    }
+    const VecD& featureImportance() const { return importances; }
+    /* 寫出模型檔（格式見 PackedNode），樹依提前結束投票的順序存放 */
+    bool save(const string& file) const{
+        ModelHeader h{};
+        memcpy(h.magic, MODEL_MAGIC, 8);
+        h.version = MODEL_VERSION;
+        h.numTrees = T;
+        h.featureDim = FEATURE_DIM;
+        h.numClasses = NUM_CLASSES;
+        h.nodeCount = packed.size();
+        ofstream fout(file, ios::binary);
+        if(!fout){
+            cerr << "Cannot write the model file: " << file << "\n";
+            return false;
+        }
+        fout.write((const char*)&h, sizeof(h));
+        fout.write((const char*)offset.data(), offset.size()*sizeof(uint32_t));
+        fout.write((const char*)packed.data(), packed.size()*sizeof(PackedNode));
+        return (bool)fout;
     }
     size_t nodeCount() const {
         size_t cnt = 0;
@@ -185,12 +733,36 @@ public:
         }
         return distance(vote.begin(),max_element(vote.begin(),vote.end()));
     }
+    /* 單筆低延遲預測：依 OOB 準確率排序的樹提前結束投票，evaluated 回傳走訪的樹數 */
+    int predictEarly(const VecI& x,double confidence,int& evaluated) const{
+        return earlyExitVote(T,order.data(),confidence,
+                             [&](int t){ return trees[t].predict(roots[t],x); },evaluated);
+    }
+    /* 批次預測（見 packedBatchVote），走訪攤平後的節點 */
+    VecI predictBatch(const MatI& X) const{
+        return packedBatchVote(packed.data(),offset.data(),T,X.size(),threads,
+                               [&](int i,uint8_t* dst){ packRow(X[i],dst); });
+    }
+    /* 同上，樣本直接取自分箱資料（out-of-core 模式的 mmap 欄式檔） */
+    VecI predictBatch(const BinnedFeatures& B) const{
+        return packedBatchVote(packed.data(),offset.data(),T,B.rows,threads,
+                               [&](int i,uint8_t* dst){ for(int f=0;f<FEATURE_DIM;++f) dst[f] = B.col(f)[i]; });
+    }
     
 private:
     int T,depth,minLeaf,maxFeat;
+    SplitMode mode;
+    int maxSplitRows;
+    int threads;
+    uint64_t seed;
     mutable vector<Node*> roots;
+    BinnedFeatures binned;
     vector<DecisionTree> trees;
-    mt19937 rng;
+    vector<array<uint16_t,NUM_CLASSES>> oobVotes;   // 每筆 20 bytes，樹數上限 65535
+    VecD importances;
+    VecI order;                 // 提前結束投票時的樹順序
+    vector<PackedNode> packed;  // 依 order 攤平的所有樹（與模型檔相同）
+    vector<uint32_t> offset;    // 第 t 棵樹的根在 packed 中的位置
 };
 
 /* ==== CSV 讀入 ==== */
@@ -212,6 +784,135 @@ bool loadCSV(const string& file, MatI& X, VecI& y){
     return true;
 }
 
+/* ==== 欄式檔（out-of-core 模式）====
+   將 CSV 串流轉成 <csv>.cols：檔頭 + FEATURE_DIM × rows 個 uint8 分箱值（行優先）+ rows 個 uint8 標籤。
+   每讀 COL_BLOCK 筆就在緩衝區轉成行優先，再逐欄寫到檔案中該欄的對應位置，記憶體用量與總筆數無關；
+   訓練時 mmap 映射，建樹只讀到抽中特徵的欄位。來源 CSV 大小或修改時間改變即重建 */
+struct ColumnHeader {
+    char    magic[8];           // "RFCOLS1\0"
+    int32_t featureDim;
+    int32_t rows;
+    int64_t srcSize;
+    int64_t srcMtime;
+};
+static const char COLS_MAGIC[8] = {'R','F','C','O','L','S','1','\0'};
+constexpr int COL_BLOCK = 16384;
+
+static bool sourceStamp(const string& file,int64_t& size,int64_t& mtime){
+    error_code ec;
+    size = (int64_t)filesystem::file_size(file,ec);
+    if(ec) return false;
+    mtime = (int64_t)filesystem::last_write_time(file,ec).time_since_epoch().count();
+    return !ec;
+}
+
+/* 計算非空白行數，決定各欄在檔案中的起點 */
+static long long countRows(const string& file){
+    ifstream fin(file,ios::binary);
+    if(!fin) return -1;
+    vector<char> buf(1<<20);
+    long long rows = 0;
+    bool nonEmpty = false;
+    while(fin.read(buf.data(),buf.size()) || fin.gcount()>0){
+        for(streamsize k=0;k<fin.gcount();++k){
+            char c = buf[k];
+            if(c=='\n'){ rows += nonEmpty; nonEmpty = false; }
+            else if(!isspace((unsigned char)c)) nonEmpty = true;
+        }
+    }
+    return rows + nonEmpty;
+}
+
+static bool buildColumnFile(const string& csv,const string& colsFile){
+    ColumnHeader h{};
+    long long rows = countRows(csv);
+    if(rows<0 || !sourceStamp(csv,h.srcSize,h.srcMtime)){
+        cerr << "Cannot open the file: " << csv << "\n";
+        return false;
+    }
+    if(rows>INT_MAX){
+        cerr << "Too many rows: " << csv << "\n";
+        return false;
+    }
+    ifstream fin(csv);
+    ofstream fout(colsFile,ios::binary);
+    if(!fout){
+        cerr << "Cannot write the column file: " << colsFile << "\n";
+        return false;
+    }
+    fout.write((const char*)&h,sizeof(h));     // 先寫空檔頭，完成後才寫入 magic，中斷的檔案不會被採用
+    const size_t base = sizeof(ColumnHeader);
+    vector<uint8_t> block((size_t)FEATURE_DIM*COL_BLOCK), labels(COL_BLOCK);
+    VecI vals;
+    string line;
+    long long done = 0;
+    int m = 0;
+    auto flush = [&](){
+        for(int f=0;f<FEATURE_DIM;++f){
+            fout.seekp(base + (size_t)f*rows + done);
+            fout.write((const char*)block.data()+(size_t)f*COL_BLOCK, m);
+        }
+        fout.seekp(base + (size_t)FEATURE_DIM*rows + done);
+        fout.write((const char*)labels.data(), m);
+        done += m; m = 0;
+    };
+    while(done+m<rows && getline(fin,line)){
+        vals.clear();
+        const char* p = line.c_str();
+        char* end;
+        for(;;){
+            long v = strtol(p,&end,10);
+            if(end==p) break;
+            vals.push_back(v);
+            p = end;
+            while(*p==',' || isspace((unsigned char)*p)) ++p;
+        }
+        if(vals.empty()) continue;
+        labels[m] = (uint8_t)vals.back(); vals.pop_back();
+        for(int f=0;f<FEATURE_DIM;++f)
+            block[(size_t)f*COL_BLOCK+m] = f<(int)vals.size() ? (uint8_t)min(max(vals[f],0),NUM_BINS-1) : 0;
+        if(++m==COL_BLOCK) flush();
+    }
+    if(m) flush();
+    if(done!=rows){
+        cerr << "Unexpected end of file: " << csv << "\n";
+        return false;
+    }
+    memcpy(h.magic,COLS_MAGIC,8);
+    h.featureDim = FEATURE_DIM;
+    h.rows = rows;
+    fout.seekp(0);
+    fout.write((const char*)&h,sizeof(h));
+    return (bool)fout;
+}
+
+static bool mapColumnFile(const string& colsFile,const string& csv,BinnedFeatures& B,VecI& y){
+    int64_t srcSize, srcMtime;
+    if(!sourceStamp(csv,srcSize,srcMtime)) return false;
+    ifstream fin(colsFile,ios::binary);
+    ColumnHeader h;
+    if(!fin.read((char*)&h,sizeof(h))) return false;
+    if(memcmp(h.magic,COLS_MAGIC,8)!=0 || h.featureDim!=FEATURE_DIM || h.rows<0
+       || h.srcSize!=srcSize || h.srcMtime!=srcMtime) return false;
+    error_code ec;
+    if(filesystem::file_size(colsFile,ec) != sizeof(h) + (size_t)(FEATURE_DIM+1)*h.rows || ec) return false;
+    vector<uint8_t> labels(h.rows);
+    fin.seekg(sizeof(h) + (size_t)FEATURE_DIM*h.rows);
+    if(!fin.read((char*)labels.data(),h.rows)) return false;
+    y.assign(labels.begin(),labels.end());
+    return B.map(colsFile,h.rows,sizeof(h));
+}
+
+/* 載入 <csv>.cols，不存在或過期時先由 CSV 建立；標籤留在記憶體，特徵只映射 */
+bool loadColumns(const string& csv,BinnedFeatures& B,VecI& y){
+    string colsFile = csv + ".cols";
+    if(mapColumnFile(colsFile,csv,B,y)) return true;
+    if(!buildColumnFile(csv,colsFile)) return false;
+    if(mapColumnFile(colsFile,csv,B,y)) return true;
+    cerr << "Invalid column file: " << colsFile << "\n";
+    return false;
+}
+
 /* ==== Macro-F1 計算 ==== */
 double macroF1(const VecI& yt,const VecI& yp){
     int tp[NUM_CLASSES]={},fp[NUM_CLASSES]={},fn[NUM_CLASSES]={};
@@ -231,13 +932,130 @@ double macroF1(const VecI& yt,const VecI& yp){
 
 
 
+/* 以最近排名法取第 p 百分位 (0 ~ 1) 的值：排序後第 ceil(p*n) 筆 */
+static double percentile(vector<double> v,double p){
+    if(v.empty()) return 0.0;
+    size_t n = v.size(), k = (size_t)max(0.0,ceil(p*n-1e-9)-1);
+    k = min(k,n-1);
+    nth_element(v.begin(),v.begin()+k,v.end());
+    return v[k];
+}
+
+/* ==== 評分模式 ====
+   載入一個或多個模型檔（mmap 共享），對 CSV 檔或 stdin 評分；stdin 逐筆評分時使用提前結束投票；
+   每列輸出各模型的預測（以逗號分隔）到 stdout，吞吐量寫到 stderr。
+   stdin 每列為 784 個像素值，可選擇性在最後附上標籤 */
+static void parseInts(const string& line, VecI& vals){
+    vals.clear();
+    const char* p = line.c_str();
+    while(*p){
+        char* end;
+        long v = strtol(p,&end,10);
+        vals.push_back((int)v);
+        p = end;
+        while(*p && *p!=',') ++p;
+        if(*p==',') ++p;
+    }
+}
+
+int runScoring(const vector<string>& modelFiles,const string& input,int nThreads,double confidence){
+    vector<unique_ptr<ForestModel>> models;
+    for(const auto& f:modelFiles){
+        models.push_back(make_unique<ForestModel>());
+        if(!models.back()->load(f)) return 1;
+    }
+    using namespace chrono;
+    int M = models.size();
+    vector<VecI> preds(M);
+    vector<double> sec(M,0.0);
+    vector<long long> treesEvaluated(M,0);
+    VecI truth;
+    size_t samples = 0;
+
+    if(input!="-"){
+        MatI X; VecI y;
+        if(!loadCSV(input,X,y)) return 1;
+        for(int m=0;m<M;++m){
+            auto t0 = steady_clock::now();
+            preds[m] = models[m]->predictBatch(X,nThreads);
+            sec[m] = duration<double>(steady_clock::now()-t0).count();
+        }
+        samples = X.size();
+        truth = y;
+        string out;
+        for(size_t i=0;i<samples;++i){
+            for(int m=0;m<M;++m) out += (m ? "," : "") + to_string(preds[m][i]);
+            out += '\n';
+        }
+        cout << out;
+    }else{
+        string line; VecI vals;
+        bool labeled = true;
+        while(getline(cin,line)){
+            if(line.empty() || line=="\r") continue;
+            parseInts(line,vals);
+            if((int)vals.size()==FEATURE_DIM+1){ truth.push_back(vals.back()); vals.pop_back(); }
+            else labeled = false;
+            vals.resize(FEATURE_DIM,0);
+            for(int m=0;m<M;++m){
+                auto t0 = steady_clock::now();
+                int evaluated;
+                preds[m].push_back(models[m]->predictEarly(vals,confidence,evaluated));
+                sec[m] += duration<double>(steady_clock::now()-t0).count();
+                treesEvaluated[m] += evaluated;
+                cout << (m ? "," : "") << preds[m].back();
+            }
+            cout << '\n' << flush;
+            ++samples;
+        }
+        if(!labeled) truth.clear();
+    }
+    for(int m=0;m<M;++m){
+        cerr << modelFiles[m] << ": " << samples << " samples, " << models[m]->numTrees() << " trees, "
+             << sec[m] << " s, throughput(samples/s)=" << (sec[m]>0 ? samples/sec[m] : 0.0);
+        if(!truth.empty()) cerr << ", F1=" << macroF1(truth,preds[m]);
+        if(treesEvaluated[m]) cerr << ", avg trees evaluated=" << (double)treesEvaluated[m]/samples;
+        cerr << "\n";
+    }
+    return 0;
+}
+
 /* ==== 主程式 ==== */
-int main(){
+int main(int argc,char* argv[]){
     string trainFile = "mnist_train.csv";
     string testFile = "mnist_test.csv";
+    string modelFile = "random_forest.model";
+    vector<string> scoreModels;
+    string input = "-";
+    int nThreads = max(1u,thread::hardware_concurrency());
+    SplitMode mode = SplitMode::Best;
+    int maxSplitRows = 0;
+    double confidence = 0.0;
+    bool outOfCore = false;
+    for(int i=1;i<argc;++i){
+        string arg = argv[i];
+        if(arg=="--threads" && i+1<argc) nThreads = max(1,atoi(argv[++i]));
+        else if(arg=="--train" && i+1<argc) trainFile = argv[++i];
+        else if(arg=="--test" && i+1<argc) testFile = argv[++i];
+        else if(arg=="--model" && i+1<argc) modelFile = argv[++i];     // 訓練後輸出的模型檔
+        else if(arg=="--score" && i+1<argc) scoreModels.push_back(argv[++i]);  // 可重複，不訓練只評分
+        else if(arg=="--input" && i+1<argc) input = argv[++i];         // 評分資料，預設 stdin
+        else if(arg=="--extra-trees") mode = SplitMode::Random;
+        else if(arg=="--out-of-core") outOfCore = true;   // 特徵不載入記憶體，改用 mmap 的欄式檔
+        else if(arg=="--confidence" && i+1<argc) confidence = atof(argv[++i]);  // 提前結束投票的近似門檻
+
+        else if(arg=="--split-rows" && i+1<argc) maxSplitRows = max(0,atoi(argv[++i]));
+        else { cerr << "Unknown argument: " << arg << "\n"; return 1; }
+    }
+    if(!scoreModels.empty()) return runScoring(scoreModels,input,nThreads,confidence);
     MatI Xtrain,Xtest; VecI ytrain,ytest;
-    loadCSV(trainFile,Xtrain,ytrain);
-    loadCSV(testFile,Xtest ,ytest );
+    BinnedFeatures Btrain,Btest;
+    if(outOfCore){
+        if(!loadColumns(trainFile,Btrain,ytrain) || !loadColumns(testFile,Btest,ytest)) return 1;
+    }else{
+        loadCSV(trainFile,Xtrain,ytrain);
+        loadCSV(testFile,Xtest ,ytest );
+    }
 
     using namespace chrono;
     auto start = high_resolution_clock::now();  // 開始計時
@@ -245,27 +1063,85 @@ int main(){
     int nTrees=50, maxDepth=12;
     int minLeaf=5, maxFeat=sqrt(FEATURE_DIM);
 
-    RandomForest rf(nTrees,maxDepth,minLeaf,maxFeat);
-    rf.fit(Xtrain,ytrain);
+    RandomForest rf(nTrees,maxDepth,minLeaf,maxFeat,mode,maxSplitRows,nThreads);
+    size_t allocBefore = allocCount.load();
+    if(outOfCore) rf.fit(Btrain,ytrain);
+    else          rf.fit(Xtrain,ytrain);
+    size_t fitAllocs = allocCount.load() - allocBefore;
 
-    VecI predTrain, predTest;
-    for(const auto& x:Xtrain) predTrain.push_back(rf.predict(x));
-    for(const auto& x:Xtest ) predTest .push_back(rf.predict(x));
+    auto predStart = high_resolution_clock::now();
+    VecI predTrain = outOfCore ? rf.predictBatch(Btrain) : rf.predictBatch(Xtrain);
+    VecI predTest  = outOfCore ? rf.predictBatch(Btest)  : rf.predictBatch(Xtest);
+    duration<double> predTime = high_resolution_clock::now() - predStart;
 
     auto end = high_resolution_clock::now();    // 結束計時
 	duration<double> duration = end - start;
 
-    ofstream("result_train.csv")<<std::accumulate(predTrain.begin(),predTrain.end(),string(""),
-        [](string a,int v){return a+to_string(v)+'\n';});
-    ofstream("result_test.csv")<<std::accumulate(predTest.begin(),predTest.end(),string(""),
-        [](string a,int v){return a+to_string(v)+'\n';});
+    /* 逐筆寫出（字串累加在百萬筆時為平方時間） */
+    {
+        ofstream resTrain("result_train.csv"), resTest("result_test.csv");
+        for(int v:predTrain) resTrain<<v<<'\n';
+        for(int v:predTest)  resTest <<v<<'\n';
+    }
 
     cout<<"Train F1="<<macroF1(ytrain,predTrain)<<"\n";
     cout<<"Test  F1="<<macroF1(ytest ,predTest )<<"\n";
 
+    /* OOB 估計：只用有袋外投票的樣本 */
+    VecI oobPred = rf.oobPredict(), oobTrue, oobHit;
+    for(size_t i=0;i<oobPred.size();++i)
+        if(oobPred[i]>=0){ oobTrue.push_back(ytrain[i]); oobHit.push_back(oobPred[i]); }
+    cout<<"OOB   F1="<<macroF1(oobTrue,oobHit)<<" ("<<oobHit.size()<<" samples)\n";
+
+    /* 重要度前 10 名的像素 */
+    const VecD& imp = rf.featureImportance();
+    VecI order(FEATURE_DIM);
+    iota(order.begin(),order.end(),0);
+    partial_sort(order.begin(),order.begin()+10,order.end(),
+                 [&](int a,int b){ return imp[a]>imp[b]; });
+    cout<<"Top features:";
+    for(int k=0;k<10;++k) cout<<" "<<order[k]<<"("<<imp[order[k]]<<")";
+    cout<<"\n";
+
+    /* 提前結束投票：完整投票與提前結束各自跑一趟測試集，先跑一趟不計時的暖身，
+       避免後跑的模式沾到前一模式留下的熱快取；另統計平均走訪樹數 */
+    vector<double> latFull, latEarly;
+    VecI predFull, predEarly;
+    long long treesEvaluated = 0;
+    VecI row;                   // out-of-core 模式下自欄式檔取出的單筆樣本
+    auto votePass = [&](bool early,vector<double>* lat,VecI& pred){
+        pred.clear();
+        if(lat) lat->clear();
+        treesEvaluated = 0;
+        for(size_t i=0;i<ytest.size();++i){
+            if(outOfCore) Btest.row(i,row);
+            const VecI& x = outOfCore ? row : Xtest[i];
+            int evaluated = nTrees;
+            auto t0 = steady_clock::now();
+            pred.push_back(early ? rf.predictEarly(x,confidence,evaluated) : rf.predict(x));
+            auto t1 = steady_clock::now();
+            if(lat) lat->push_back(chrono::duration<double,micro>(t1-t0).count());
+            treesEvaluated += evaluated;
+        }
+    };
+    votePass(false,nullptr,predFull);  votePass(false,&latFull,predFull);
+    votePass(true,nullptr,predEarly);  votePass(true,&latEarly,predEarly);
+    int changed = 0;            // 與完整投票結果不同的筆數（僅 confidence > 0 時可能非 0）
+    for(size_t i=0;i<predEarly.size();++i) changed += predFull[i]!=predEarly[i];
+    if(!ytest.empty()){
+        cout<<"Early exit: avg trees evaluated="<<(double)treesEvaluated/ytest.size()<<"/"<<nTrees
+            <<", p50 latency(us) "<<percentile(latFull,0.5)<<" -> "<<percentile(latEarly,0.5)
+            <<", p99 latency(us) "<<percentile(latFull,0.99)<<" -> "<<percentile(latEarly,0.99)
+            <<", changed="<<changed<<", Test F1="<<macroF1(ytest,predEarly)<<"\n";
+    }
+
     cout << "Total nodes in tree:  = " << rf.nodeCount() << '\n';
     cout << "Average leaf depth: " << rf.averageLeafDepth() << '\n';
     cout << "Node size:" << sizeof(Node) << endl;
+    cout << "Allocations in fit: " << fitAllocs << " (" << (double)fitAllocs/max<size_t>(1,rf.nodeCount()) << " per node)" << endl;
+    cout << "Peak RSS (MB): " << peakRSSMB() << endl;
     cout << "running time: " << duration.count() << endl;
+    cout << "predict time: " << predTime.count() << endl;
+    if(rf.save(modelFile)) cout << "Model saved: " << modelFile << endl;
     return 0;
 }